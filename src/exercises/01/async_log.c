@@ -0,0 +1,179 @@
+#include "async_log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_BATCH_SIZE		65536	/* bytes handed to a single fwrite() */
+#define LOG_POLL_INTERVAL	1000000	/* logger sleep when all the rings are empty (1 ms) */
+
+static _Atomic(log_ring*) rings;	/* registry of all the rings ever used */
+static atomic_int running;
+static atomic_ulong flush_requests, flushes_done;
+static pthread_t logger;
+static pthread_key_t ring_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static __thread log_ring* my_ring;
+
+static uint64_t log_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// thread-exit destructor: the logger still drains what is left in the ring
+static void release_ring(void* arg) {
+	log_ring* r = arg;
+	atomic_store_explicit(&r->in_use, 0, memory_order_release);
+}
+
+static void make_key(void) {
+	pthread_key_create(&ring_key, release_ring);
+}
+
+// reuses the ring of a thread that has exited, or registers a new one
+static log_ring* acquire_ring(void) {
+	log_ring* r;
+	for (r = atomic_load(&rings); r != NULL; r = r->next) {
+		int free_ring = 0;
+		if (atomic_compare_exchange_strong_explicit(&r->in_use, &free_ring, 1,
+				memory_order_acquire, memory_order_relaxed))
+			goto out;
+	}
+
+	r = aligned_alloc(64, sizeof(log_ring));
+	if (r == NULL) return NULL;
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->head, 0);
+	atomic_init(&r->in_use, 1);
+	r->limit = 0;
+	r->next = atomic_load(&rings);
+	while (!atomic_compare_exchange_weak(&rings, &r->next, r))
+		;
+out:
+	pthread_once(&key_once, make_key);
+	pthread_setspecific(ring_key, r);
+	return r;
+}
+
+void log_write(const char* fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+
+	if (!atomic_load_explicit(&running, memory_order_relaxed) ||
+	    (my_ring == NULL && (my_ring = acquire_ring()) == NULL)) {
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	log_ring* r = my_ring;
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	// a full ring means the logger is behind: wait for it instead of dropping messages
+	while (tail - atomic_load_explicit(&r->head, memory_order_acquire) == LOG_RING_SIZE)
+		sched_yield();
+
+	log_record* rec = &r->records[tail & (LOG_RING_SIZE - 1)];
+	int len = vsnprintf(rec->msg, LOG_MSG_SIZE, fmt, ap);
+	va_end(ap);
+	if (len < 0) len = 0;
+	if (len >= LOG_MSG_SIZE) {
+		// keep the line break of a truncated message
+		len = LOG_MSG_SIZE - 1;
+		if (fmt[0] != '\0' && fmt[strlen(fmt) - 1] == '\n') rec->msg[len - 1] = '\n';
+	}
+	rec->len = len;
+	rec->ts_ns = log_now();
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/*
+ * Writes out every record published so far, oldest first across the rings.
+ * Tails are sampled once, so the pass terminates even if threads keep logging.
+ * Returns the number of records written.
+ */
+static size_t drain(char* batch) {
+	size_t count = 0, used = 0;
+	log_ring* r;
+
+	for (r = atomic_load(&rings); r != NULL; r = r->next)
+		r->limit = atomic_load_explicit(&r->tail, memory_order_acquire);
+	while (1) {
+		log_ring* oldest = NULL;
+		log_record* rec = NULL;
+		for (r = atomic_load(&rings); r != NULL; r = r->next) {
+			size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+			if (head == r->limit) continue;
+			log_record* cand = &r->records[head & (LOG_RING_SIZE - 1)];
+			if (rec == NULL || cand->ts_ns < rec->ts_ns) {
+				oldest = r;
+				rec = cand;
+			}
+		}
+		if (oldest == NULL) break;
+
+		if (used + rec->len > LOG_BATCH_SIZE) {
+			fwrite(batch, 1, used, stdout);
+			used = 0;
+		}
+		memcpy(batch + used, rec->msg, rec->len);
+		used += rec->len;
+		atomic_fetch_add_explicit(&oldest->head, 1, memory_order_release);
+		count++;
+	}
+	if (used > 0) {
+		fwrite(batch, 1, used, stdout);
+		fflush(stdout);
+	}
+	return count;
+}
+
+static void* logger_thread(void* arg) {
+	char* batch = arg;
+	struct timespec pause = { 0, LOG_POLL_INTERVAL };
+
+	while (1) {
+		unsigned long requested = atomic_load(&flush_requests);
+		int stop = !atomic_load(&running);
+		size_t written = drain(batch);
+		if (atomic_load(&flushes_done) < requested)
+			atomic_store(&flushes_done, requested);
+		if (stop) break;
+		if (written == 0 && atomic_load(&flush_requests) == requested)
+			nanosleep(&pause, NULL);
+	}
+	free(batch);
+	return NULL;
+}
+
+// starts the logger thread, returns 0 or an error number
+int log_init(void) {
+	char* batch = malloc(LOG_BATCH_SIZE);
+	if (batch == NULL) return ENOMEM;
+
+	atomic_store(&running, 1);
+	int ret = pthread_create(&logger, NULL, logger_thread, batch);
+	if (ret) {
+		atomic_store(&running, 0);
+		free(batch);
+	}
+	return ret;
+}
+
+// returns once every message logged before the call has been written
+void log_flush(void) {
+	if (!atomic_load(&running)) return;
+	unsigned long ticket = atomic_fetch_add(&flush_requests, 1) + 1;
+	while (atomic_load(&flushes_done) < ticket)
+		sched_yield();
+}
+
+// writes out the remaining messages and stops the logger thread
+void log_shutdown(void) {
+	if (!atomic_exchange(&running, 0)) return;
+	pthread_join(logger, NULL);
+}
@@ -0,0 +1,77 @@
+#ifndef __ASYNC_LOG__
+#define __ASYNC_LOG__
+
+#include <stdatomic.h>
+#include <stddef.h>	/* size_t */
+#include <stdint.h>
+
+/*
+ * Asynchronous logging. A thread formats its message into a fixed-size
+ * record and appends it to its own single-producer ring, which costs no
+ * lock and no system call; a background thread collects the records of all
+ * the rings, merges them by timestamp and writes them to stdout in batches.
+ * Rings are registered on first use and recycled when their thread exits.
+ *
+ * log_shutdown() writes out what is left and must be called once the
+ * logging threads are done.
+ *
+ * Messages above LOG_LEVEL are removed at compile time, arguments included
+ * (e.g. -DLOG_LEVEL=LOG_LEVEL_WARN). Before log_init(), or after
+ * log_shutdown(), log_write() falls back to a plain printf.
+ */
+
+#define LOG_LEVEL_NONE	0
+#define LOG_LEVEL_ERROR	1
+#define LOG_LEVEL_WARN	2
+#define LOG_LEVEL_INFO	3
+#define LOG_LEVEL_DEBUG	4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL	LOG_LEVEL_INFO
+#endif
+
+#define LOG_MSG_SIZE	116	/* longer messages are truncated */
+#define LOG_RING_SIZE	1024	/* records per thread, a power of two */
+
+typedef struct {
+	uint64_t ts_ns;		/* CLOCK_MONOTONIC, orders records of different threads */
+	int len;
+	char msg[LOG_MSG_SIZE];
+} log_record;
+
+typedef struct log_ring {
+	_Alignas(64) atomic_size_t tail;	/* written by the owner thread */
+	_Alignas(64) atomic_size_t head;	/* written by the logger thread */
+	atomic_int in_use;		/* 0 once the owner has exited */
+	size_t limit;			/* tail sampled by the logger at the start of a pass */
+	struct log_ring* next;		/* registry, rings are never unlinked */
+	log_record records[LOG_RING_SIZE];
+} log_ring;
+
+int log_init(void);
+void log_write(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_flush(void);
+void log_shutdown(void);
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define log_error(...)	log_write(__VA_ARGS__)
+#else
+#define log_error(...)	do { } while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define log_warn(...)	log_write(__VA_ARGS__)
+#else
+#define log_warn(...)	do { } while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define log_info(...)	log_write(__VA_ARGS__)
+#else
+#define log_info(...)	do { } while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define log_debug(...)	log_write(__VA_ARGS__)
+#else
+#define log_debug(...)	do { } while (0)
+#endif
+
+#endif
@@ -1,50 +1,129 @@
+#include "../performance.h"
+#include "../threadpool.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <errno.h>
+#include <sys/resource.h>
 
 #define N 1000 // number of threads
 #define M 10000 // number of iterations per thread
 #define V 1 // value added to the balance by each thread at each iteration
 
+#define CACHE_LINE 64
+#define POOL_STACK_SIZE (64*1024) // the workers only need a few frames
+
+/*
+ * Where each thread keeps its counter:
+ * - LAYOUT_PACKED: adjacent slots of one array, so 8 threads share a cache line
+ * - LAYOUT_PADDED: one slot per cache line
+ * - LAYOUT_LOCAL: a slot on the stack of the unit of work, copied to the array
+ *   once at the end (a __thread slot would carry over between pool tasks)
+ * Every add goes through a volatile access so that the compiler cannot keep
+ * the counter in a register and all layouts perform the same memory traffic.
+ */
+#define LAYOUT_PACKED 0
+#define LAYOUT_PADDED 1
+#define LAYOUT_LOCAL 2
+
+typedef struct {
+	unsigned long int value;
+	char pad[CACHE_LINE - sizeof(unsigned long int)];
+} padded_slot;
+
 unsigned long int* shared;
-int n = N, m = M, v = V;
+padded_slot* shared_padded;
+int n = N, m = M, v = V, layout = LAYOUT_PACKED, use_pool = 0;
+
+const char* layout_names[] = { "packed", "padded", "local" };
 
 void* thread_work(void *arg) {
 	
     int thread_idx = *((int*)arg);
     int i; 
-	for (i = 0; i < m; i++)
-		shared[thread_idx] += v;
+	if (layout == LAYOUT_PACKED) {
+		volatile unsigned long int* slot = &shared[thread_idx];
+		for (i = 0; i < m; i++)
+			*slot += v;
+	} else if (layout == LAYOUT_PADDED) {
+		volatile unsigned long int* slot = &shared_padded[thread_idx].value;
+		for (i = 0; i < m; i++)
+			*slot += v;
+	} else {
+		volatile unsigned long int local_slot = 0;
+		for (i = 0; i < m; i++)
+			local_slot += v;
+		shared[thread_idx] = local_slot; // folded by main after the join
+	}
 	return NULL;
 }
 
+void task_work(void *arg) {
+	thread_work(arg);
+}
+
 int main(int argc, char **argv)
 {
 	if (argc > 1) n = atoi(argv[1]);
 	if (argc > 2) m = atoi(argv[2]);
 	if (argc > 3) v = atoi(argv[3]);
+	if (argc > 4) {
+		for (layout = LAYOUT_LOCAL; layout >= 0; layout--)
+			if (strcmp(argv[4], layout_names[layout]) == 0) break;
+		if (layout < 0) {
+			fprintf(stderr, "Unknown layout %s, use packed, padded or local\n", argv[4]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	// a fifth argument "pool" runs the n units of work on a pool with one thread per CPU
+	if (argc > 5) use_pool = (strcmp(argv[5], "pool") == 0);
 	shared = (unsigned long int*)calloc(n, sizeof(unsigned long int));
+	if (layout == LAYOUT_PADDED) {
+		shared_padded = (padded_slot*)aligned_alloc(CACHE_LINE, n * sizeof(padded_slot));
+		memset(shared_padded, 0, n * sizeof(padded_slot));
+	}
+	timer t, creation;
+	thread_pool pool;
+	tp_config pool_config = { 0, POOL_STACK_SIZE, 1 };
 
-	printf("Going to start %d threads, each adding %d times %d to a shared variable initialized to zero...", n, m, v); fflush(stdout);
+	printf("Going to start %d %s, each adding %d times %d to a shared variable initialized to zero (%s layout)...", n, use_pool ? "pool tasks" : "threads", m, v, layout_names[layout]); fflush(stdout);
 	pthread_t* threads = (pthread_t*)malloc(n * sizeof(pthread_t)); // also calloc(n,sizeof(pthread_t))
 	int* thread_ids = (int*)malloc(n * sizeof(int));
     int i;
+	begin(&t);
+	begin(&creation);
+	if (use_pool) {
+		int ret = tp_init(&pool, &pool_config);
+		if (ret != 0) {
+			fprintf(stderr, "Can't create the thread pool, error %d\n", ret);
+			exit(EXIT_FAILURE);
+		}
+	}
 	for (i = 0; i < n; i++){
         thread_ids[i] = i;
-		if (pthread_create(&threads[i], NULL, thread_work, &thread_ids[i]) != 0) {
+		if (use_pool) {
+			if (tp_submit(&pool, task_work, &thread_ids[i]) != 0) {
+				fprintf(stderr, "Can't submit a new task\n");
+				exit(EXIT_FAILURE);
+			}
+		} else if (pthread_create(&threads[i], NULL, thread_work, &thread_ids[i]) != 0) {
 			fprintf(stderr, "Can't create a new thread, error %d\n", errno);
 			exit(EXIT_FAILURE);
 		}
     }
+	end(&creation);
 	printf("ok\n");
 
-	printf("Waiting for the termination of all the %d threads...", n); fflush(stdout);
+	printf("Waiting for the termination of all the %d %s...", n, use_pool ? "tasks" : "threads"); fflush(stdout);
+	if (use_pool) tp_wait(&pool);
     unsigned long int value = 0;
 	for (i = 0; i < n; i++){
-		pthread_join(threads[i], NULL);
-        value += shared[i];
+		if (!use_pool) pthread_join(threads[i], NULL);
+        value += (layout == LAYOUT_PADDED) ? shared_padded[i].value : shared[i];
     }
+	end(&t);
+	if (use_pool) tp_destroy(&pool);
 	printf("ok\n");
 
 	unsigned long int expected_value = (unsigned long int)n*m*v;
@@ -53,7 +132,12 @@ int main(int argc, char **argv)
 		unsigned long int lost_adds = (expected_value - value) / v;
 		printf("Number of lost adds: %lu\n", lost_adds);
 	}
+	printf("Time: %lu ms (%.2f ns per add)\n", get_milliseconds(&t), (double)get_nanoseconds(&t) / ((unsigned long int)n*m));
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Creation: %lu us, peak RSS: %ld KB\n", get_microseconds(&creation), usage.ru_maxrss);
     free(shared);
+    free(shared_padded);
     free(threads);
     free(thread_ids);
 
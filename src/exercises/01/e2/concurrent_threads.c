@@ -1,68 +1,179 @@
 #include "../performance.h"
+#include "../sharded_counter.h"
+#include "../threadpool.h"
+#include "locks.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <errno.h>
 #include <semaphore.h>
+#include <sys/resource.h>
 
 #define N 1000 // number of threads
 #define M 10000 // number of iterations per thread
 #define V 1 // value added to the balance by each thread at each iteration
 
+// synchronization backends for the critical section, selected by the fourth argument
+#define BACKEND_SEM 0
+#define BACKEND_MUTEX 1
+#define BACKEND_TTAS 2
+#define BACKEND_TICKET 3
+#define BACKEND_MCS 4
+#define BACKEND_ATOMIC 5
+#define BACKEND_SHARDED 6
+#define NUM_BACKENDS 7
+
+#define POOL_STACK_SIZE (64*1024) // the workers only need a few frames
+
+const char* backend_names[] = { "sem", "mutex", "ttas", "ticket", "mcs", "atomic", "sharded" };
+
 sem_t sem;
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+ttas_lock_t ttas;
+ticket_lock_t ticket;
+mcs_lock_t mcs;
 unsigned long int shared_variable;
-int n = N, m = M, v = V;
+atomic_ulong shared_atomic; // used instead of shared_variable by BACKEND_ATOMIC
+sharded_counter shared_sharded; // used instead of shared_variable by BACKEND_SHARDED
+int n = N, m = M, v = V, backend = BACKEND_SEM, use_pool = 0;
 
 void* thread_work(void *arg) {
+	histogram* h = (histogram*)arg; // private to this thread, merged by main after the join
+	mcs_node_t node;
 	int i;
 	for (i = 0; i < m; i++){
-		if (sem_wait(&sem) != 0) {
-			fprintf(stderr, "errore in acquisizione\n");
-			return NULL;
+		begin_local();
+		switch (backend) {
+			case BACKEND_SEM:
+				if (sem_wait(&sem) != 0) {
+					fprintf(stderr, "errore in acquisizione\n");
+					return NULL;
+				}
+				shared_variable += v;
+				if (sem_post(&sem) != 0) {
+					fprintf(stderr, "errore in rilascio\n");
+					return NULL;
+				}
+				break;
+			case BACKEND_MUTEX:
+				pthread_mutex_lock(&mutex);
+				shared_variable += v;
+				pthread_mutex_unlock(&mutex);
+				break;
+			case BACKEND_TTAS:
+				ttas_lock(&ttas);
+				shared_variable += v;
+				ttas_unlock(&ttas);
+				break;
+			case BACKEND_TICKET:
+				ticket_lock(&ticket);
+				shared_variable += v;
+				ticket_unlock(&ticket);
+				break;
+			case BACKEND_MCS:
+				mcs_lock(&mcs, &node);
+				shared_variable += v;
+				mcs_unlock(&mcs, &node);
+				break;
+			case BACKEND_ATOMIC:
+				atomic_fetch_add_explicit(&shared_atomic, v, memory_order_relaxed);
+				break;
+			case BACKEND_SHARDED:
+				sc_add(&shared_sharded, v);
+				break;
 		}
-		
-		shared_variable += v;
-		
-		if (sem_post(&sem) != 0) {
-			fprintf(stderr, "errore in rilascio\n");
-			return NULL;
-		}
-		
+		hist_record(h, end_local());
 	}
 	return NULL;
 }
 
+void task_work(void *arg) {
+	thread_work(arg);
+}
+
 int main(int argc, char **argv)
 {
 	if (argc > 1) n = atoi(argv[1]);
 	if (argc > 2) m = atoi(argv[2]);
 	if (argc > 3) v = atoi(argv[3]);
+	if (argc > 4) {
+		for (backend = NUM_BACKENDS - 1; backend >= 0; backend--)
+			if (strcmp(argv[4], backend_names[backend]) == 0) break;
+		if (backend < 0) {
+			fprintf(stderr, "Unknown backend %s, use sem, mutex, ttas, ticket, mcs, atomic or sharded\n", argv[4]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	// a fifth argument "pool" runs the n units of work on a pool with one thread per CPU
+	if (argc > 5) use_pool = (strcmp(argv[5], "pool") == 0);
 	shared_variable = 0;
-	timer t;
+	atomic_init(&shared_atomic, 0);
+	ttas_init(&ttas);
+	ticket_init(&ticket);
+	mcs_init(&mcs);
+	if (sc_init(&shared_sharded, 0, SC_BY_CPU) != 0) {
+		fprintf(stderr, "Can't allocate the sharded counter\n");
+		exit(EXIT_FAILURE);
+	}
+	timer t, creation;
+	thread_pool pool;
+	tp_config pool_config = { 0, POOL_STACK_SIZE, 1 };
 	
-	printf("Going to start %d threads, each adding %d times %d to a shared variable initialized to zero...", n, m, v); fflush(stdout);
+	printf("Going to start %d %s, each adding %d times %d to a shared variable initialized to zero (%s backend)...", n, use_pool ? "pool tasks" : "threads", m, v, backend_names[backend]); fflush(stdout);
 	pthread_t* threads = (pthread_t*)malloc(n * sizeof(pthread_t));
+	histogram* hists = (histogram*)malloc(n * sizeof(histogram));
+	histogram pair_hist;
 	int i;
 	
+	perf_calibrate();
 	if (sem_init(&sem, 0, 1) != 0) {
 		fprintf(stderr, "init error\n");
 		exit(EXIT_FAILURE);
 	}
 	
-	begin(&t);
-	
 	for (i = 0; i < n; i++)
-		if (pthread_create(&threads[i], NULL, thread_work, NULL) != 0) {
+		hist_init(&hists[i]);
+	
+	begin(&t);
+	begin(&creation);
+	if (use_pool) {
+		int ret = tp_init(&pool, &pool_config);
+		if (ret != 0) {
+			fprintf(stderr, "Can't create the thread pool, error %d\n", ret);
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (use_pool) {
+			if (tp_submit(&pool, task_work, &hists[i]) != 0) {
+				fprintf(stderr, "Can't submit a new task\n");
+				exit(EXIT_FAILURE);
+			}
+		} else if (pthread_create(&threads[i], NULL, thread_work, &hists[i]) != 0) {
 			fprintf(stderr, "Can't create a new thread, error %d\n", errno);
 			exit(EXIT_FAILURE);
 		}
+	}
+	end(&creation);
 	printf("ok\n");
 	
-	printf("Waiting for the termination of all the %d threads...", n); fflush(stdout);
-	for (i = 0; i < n; i++)
-		pthread_join(threads[i], NULL);
+	printf("Waiting for the termination of all the %d %s...", n, use_pool ? "tasks" : "threads"); fflush(stdout);
+	if (use_pool) {
+		tp_wait(&pool);
+	} else {
+		for (i = 0; i < n; i++)
+			pthread_join(threads[i], NULL);
+	}
 	end(&t);
+	if (use_pool) tp_destroy(&pool);
 	printf("ok\n");
+	if (backend == BACKEND_ATOMIC) shared_variable = atomic_load(&shared_atomic);
+	if (backend == BACKEND_SHARDED) shared_variable = sc_quiesce_sum(&shared_sharded);
+	
+	hist_init(&pair_hist);
+	for (i = 0; i < n; i++)
+		hist_merge(&pair_hist, &hists[i]);
 	
 	unsigned long int expected_value = (unsigned long int)n*m*v;
 	printf("The value of the shared variable is %lu. It should have been %lu\n", shared_variable, expected_value);
@@ -72,8 +183,14 @@ int main(int argc, char **argv)
 	}
 	
 	printf("Time: %lu ms\n", get_milliseconds(&t));
+	hist_print(&pair_hist, "acquire/release pair");
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Creation: %lu us, peak RSS: %ld KB\n", get_microseconds(&creation), usage.ru_maxrss);
 	free(threads);
+	free(hists);
 	sem_destroy(&sem);
+	sc_destroy(&shared_sharded);
 	return EXIT_SUCCESS;
 }
 
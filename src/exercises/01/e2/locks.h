@@ -0,0 +1,160 @@
+#ifndef __LOCKS__
+#define __LOCKS__
+
+#include <linux/futex.h>
+#include <sched.h>      /* sched_yield */
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * Busy-waiting locks for short critical sections. With many more threads
+ * than cores a spinning waiter may be waiting for a preempted holder, so
+ * every spin loop yields the CPU after SPIN_BEFORE_YIELD attempts.
+ */
+#define SPIN_BEFORE_YIELD	1024
+#define SPIN_BEFORE_PARK	128
+#define BACKOFF_MIN		4
+#define BACKOFF_MAX		1024
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static inline void spin_wait(unsigned int* spins) {
+	if (++(*spins) < SPIN_BEFORE_YIELD) {
+		cpu_relax();
+	} else {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+/* test-and-test-and-set spinlock with exponential backoff */
+typedef struct {
+	atomic_int locked;
+} ttas_lock_t;
+
+static inline void ttas_init(ttas_lock_t* l) {
+	atomic_init(&l->locked, 0);
+}
+
+static inline void ttas_lock(ttas_lock_t* l) {
+	unsigned int backoff = BACKOFF_MIN, spins = 0, i;
+	while (1) {
+		// spin on a plain load so that waiters share the line instead of bouncing it
+		while (atomic_load_explicit(&l->locked, memory_order_relaxed))
+			spin_wait(&spins);
+		if (!atomic_exchange_explicit(&l->locked, 1, memory_order_acquire))
+			return;
+		for (i = 0; i < backoff; i++)
+			cpu_relax();
+		if (backoff < BACKOFF_MAX) backoff <<= 1;
+		else sched_yield();
+	}
+}
+
+static inline void ttas_unlock(ttas_lock_t* l) {
+	atomic_store_explicit(&l->locked, 0, memory_order_release);
+}
+
+/*
+ * Ticket lock: FIFO, one atomic increment to take a ticket. A waiter that
+ * is not next in line cannot get the lock soon, so it yields right away.
+ */
+typedef struct {
+	atomic_uint next;
+	atomic_uint serving;
+} ticket_lock_t;
+
+static inline void ticket_init(ticket_lock_t* l) {
+	atomic_init(&l->next, 0);
+	atomic_init(&l->serving, 0);
+}
+
+static inline void ticket_lock(ticket_lock_t* l) {
+	unsigned int spins = 0;
+	unsigned int ticket = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+	unsigned int serving;
+	while ((serving = atomic_load_explicit(&l->serving, memory_order_acquire)) != ticket) {
+		if (ticket - serving > 1) sched_yield();
+		else spin_wait(&spins);
+	}
+}
+
+static inline void ticket_unlock(ticket_lock_t* l) {
+	unsigned int next = atomic_load_explicit(&l->serving, memory_order_relaxed) + 1;
+	atomic_store_explicit(&l->serving, next, memory_order_release);
+}
+
+/*
+ * MCS queue lock: FIFO, and every waiter waits on its own node, so a
+ * release touches only the cache line of the next waiter. The node must
+ * stay alive from mcs_lock() to the matching mcs_unlock().
+ * With more threads than cores the FIFO handoff may go to a preempted
+ * waiter, and spinning or yielding waiters would keep it off the CPU
+ * while the whole queue waits for it. So a queued waiter spins only for
+ * SPIN_BEFORE_PARK polls and then parks on a futex on its node: the
+ * release wakes exactly the next waiter, the others sleep. When
+ * oversubscribed, every handoff costs a futex wake and a context switch.
+ */
+#define MCS_UNLOCKED	0
+#define MCS_WAITING	1
+#define MCS_PARKED	2
+
+typedef struct mcs_node_s {
+	_Atomic(struct mcs_node_s*) next;
+	atomic_int locked;	/* MCS_WAITING or MCS_PARKED until handed the lock */
+} mcs_node_t;
+
+typedef struct {
+	_Atomic(mcs_node_t*) tail;
+} mcs_lock_t;
+
+static inline void mcs_init(mcs_lock_t* l) {
+	atomic_init(&l->tail, NULL);
+}
+
+static inline void mcs_lock(mcs_lock_t* l, mcs_node_t* node) {
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&node->locked, MCS_WAITING, memory_order_relaxed);
+
+	mcs_node_t* pred = atomic_exchange_explicit(&l->tail, node, memory_order_acq_rel);
+	if (pred == NULL) return;
+
+	atomic_store_explicit(&pred->next, node, memory_order_release);
+	unsigned int spins = 0;
+	while (atomic_load_explicit(&node->locked, memory_order_acquire) != MCS_UNLOCKED) {
+		if (++spins < SPIN_BEFORE_PARK) {
+			cpu_relax();
+			continue;
+		}
+		int waiting = MCS_WAITING;
+		if (atomic_compare_exchange_strong_explicit(&node->locked, &waiting, MCS_PARKED,
+				memory_order_acquire, memory_order_acquire) || waiting == MCS_PARKED)
+			syscall(SYS_futex, &node->locked, FUTEX_WAIT_PRIVATE, MCS_PARKED, NULL, NULL, 0);
+	}
+}
+
+static inline void mcs_unlock(mcs_lock_t* l, mcs_node_t* node) {
+	mcs_node_t* next = atomic_load_explicit(&node->next, memory_order_acquire);
+	if (next == NULL) {
+		mcs_node_t* expected = node;
+		if (atomic_compare_exchange_strong_explicit(&l->tail, &expected, NULL,
+				memory_order_acq_rel, memory_order_relaxed))
+			return;
+		// a successor has swapped the tail but has not linked itself yet
+		while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL)
+			sched_yield();
+	}
+	// the successor may return and drop its node before the wake, which is then spurious
+	if (atomic_exchange_explicit(&next->locked, MCS_UNLOCKED, memory_order_release) == MCS_PARKED)
+		syscall(SYS_futex, &next->locked, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+#endif
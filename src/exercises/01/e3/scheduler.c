@@ -6,12 +6,15 @@
 #include <string.h>     // strerror() formats errno into a human-readable string
 #include <unistd.h>     // sleep()
 
+#include "../threadpool.h"
+
 /* Some constants */
 
 #define MAX_SLEEP       3   // used to simulate a work item (max length)
 #define NUM_RESOURCES   3   // number of available special resources
 #define NUM_TASKS       3   // we define the number of work items per thread
 #define THREAD_BURST    5   // determines how many threads are spawned at the same time
+#define POOL_STACK_SIZE (64*1024) // stack of the pool workers, they only need a few frames
 
 /* We use a simple structure to encapsulate a thread's arguments */
 typedef struct thread_args_s {
@@ -21,8 +24,8 @@ typedef struct thread_args_s {
 } thread_args_t;
 
 
-/* This is the function executed when a client thread is created */
-void* client(void* arg_ptr) {
+/* This is the task executed by a pool worker for each client */
+void client(void* arg_ptr) {
     thread_args_t* args = (thread_args_t*) arg_ptr;
     
     int i, ret = 0;
@@ -52,7 +55,6 @@ void* client(void* arg_ptr) {
     printf("[@Thread%d] Done. Resource released!\n", args->ID);
     
     free(args); // I should free my own arguments!
-    return NULL;
 }
 
 int main(int argc, char* argv[]) {
@@ -63,6 +65,20 @@ int main(int argc, char* argv[]) {
     int ret = 0;
     int thread_ID = 0;
     
+    /* Instead of spawning a thread per client, we run the clients on a
+     * pool: at most NUM_RESOURCES of them can work at the same time, so
+     * NUM_RESOURCES workers are enough and the other clients wait in the
+     * pool's queue instead of blocking a thread of their own. */
+    thread_pool pool;
+    tp_config pool_config = { NUM_RESOURCES, POOL_STACK_SIZE, 0 };
+    
+    ret = tp_init(&pool, &pool_config);
+    
+    if (ret) {
+        fprintf(stderr,"Cannot create the thread pool: %s\n", strerror(ret));
+        exit(1);
+    }
+    
     sem_t* semaphore = malloc(sizeof(sem_t)); // we allocate a sem_t object on the heap
     
     ret = sem_init(semaphore, 0, NUM_RESOURCES);
@@ -90,33 +106,32 @@ int main(int argc, char* argv[]) {
         
         int i;
         for (i = 0; i < THREAD_BURST; ++i) {
-            pthread_t thread_handle;
-            
             thread_args_t* args = malloc(sizeof(thread_args_t));
             args->semaphore = semaphore;
             args->ID = thread_ID;
             args->num_tasks = NUM_TASKS;
             
-            if (pthread_create(&thread_handle, NULL, client, args)) {
-                printf("==> [DRIVER] FATAL ERROR: cannot create thread %d: %s\nExiting...\n", thread_ID, strerror(errno));
+            ret = tp_submit(&pool, client, args);
+            if (ret) {
+                printf("==> [DRIVER] FATAL ERROR: cannot submit client %d: %s\nExiting...\n", thread_ID, strerror(ret));
                 exit(1);
             }
             
             ++thread_ID;
-            
-            // I won't wait for this thread: it's a good idea to detach it!
-            pthread_detach(thread_handle);
         }
         
         printf("==> [DRIVER] Press ENTER to spawn %d new threads. Press CTRL+D to quit!\n", THREAD_BURST);
     }
     
-    printf("Exiting...\n");
+    printf("Waiting for the queued clients to complete and then exiting...\n");
+    
+    // the clients still use the semaphore, so we must wait for them before destroying it
+    tp_destroy(&pool);
     
     /*** Don't forget to destroy the semaphore once you're done ***/
     sem_destroy(semaphore);
     
     free(semaphore);
     
-    pthread_exit(NULL);
+    exit(0);
 }
@@ -0,0 +1,182 @@
+#include "futex_sync.h"
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()	__builtin_ia32_pause()
+#else
+#define cpu_relax()	do { } while (0)
+#endif
+
+// sleeps while *addr == val; returns 0 or an error number (EAGAIN, EINTR, ETIMEDOUT)
+static int futex_wait(void* addr, int val, const struct timespec* abstime, int private) {
+	int op = (abstime ? FUTEX_WAIT_BITSET : FUTEX_WAIT) | private;
+	if (syscall(SYS_futex, addr, op, val, abstime, NULL, FUTEX_BITSET_MATCH_ANY) == -1)
+		return errno;
+	return 0;
+}
+
+static void futex_wake(void* addr, int count, int private) {
+	syscall(SYS_futex, addr, FUTEX_WAKE | private, count, NULL, NULL, 0);
+}
+
+/* Counting semaphore */
+
+int fsem_init(fsem_t* s, int pshared, unsigned int value) {
+	if (value > INT_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	atomic_init(&s->value, (int)value);
+	atomic_init(&s->waiters, 0);
+	s->spin = FSEM_SPIN;
+	s->private = pshared ? 0 : FUTEX_PRIVATE_FLAG;
+	return 0;
+}
+
+int fsem_destroy(fsem_t* s) {
+	(void)s;
+	return 0;
+}
+
+void fsem_set_spin(fsem_t* s, int spin) {
+	s->spin = spin < 0 ? 0 : spin;
+}
+
+int fsem_trywait(fsem_t* s) {
+	int v = atomic_load_explicit(&s->value, memory_order_relaxed);
+	while (v > 0) {
+		if (atomic_compare_exchange_weak_explicit(&s->value, &v, v - 1,
+				memory_order_acquire, memory_order_relaxed))
+			return 0;
+	}
+	errno = EAGAIN;
+	return -1;
+}
+
+// CLOCK_REALTIME deadline as for sem_timedwait(), NULL waits forever
+int fsem_timedwait(fsem_t* s, const struct timespec* abstime) {
+	int i;
+	for (i = 0; i <= s->spin; i++) {
+		if (fsem_trywait(s) == 0) return 0;
+		cpu_relax();
+	}
+
+	/*
+	 * Announce ourselves before the last check: a poster increments value
+	 * and then looks at waiters, we increment waiters and then look at
+	 * value, so at least one of the two sees the other.
+	 */
+	atomic_fetch_add(&s->waiters, 1);
+	while (fsem_trywait(s) != 0) {
+		int ret = futex_wait(&s->value, 0, abstime, s->private | (abstime ? FUTEX_CLOCK_REALTIME : 0));
+		if (ret == ETIMEDOUT || (ret == EINTR && abstime != NULL)) {
+			atomic_fetch_sub(&s->waiters, 1);
+			errno = ret;
+			return -1;
+		}
+	}
+	atomic_fetch_sub(&s->waiters, 1);
+	return 0;
+}
+
+int fsem_wait(fsem_t* s) {
+	return fsem_timedwait(s, NULL);
+}
+
+int fsem_post(fsem_t* s) {
+	if (atomic_fetch_add(&s->value, 1) == INT_MAX) {
+		atomic_fetch_sub(&s->value, 1);
+		errno = EOVERFLOW;
+		return -1;
+	}
+	if (atomic_load(&s->waiters) > 0)
+		futex_wake(&s->value, 1, s->private);
+	return 0;
+}
+
+int fsem_getvalue(fsem_t* s, int* sval) {
+	*sval = atomic_load_explicit(&s->value, memory_order_relaxed);
+	return 0;
+}
+
+/* Event */
+
+int fevent_init(fevent_t* ev, int pshared, int manual, int set) {
+	atomic_init(&ev->state, set ? 1 : 0);
+	atomic_init(&ev->waiters, 0);
+	ev->manual = manual;
+	ev->private = pshared ? 0 : FUTEX_PRIVATE_FLAG;
+	return 0;
+}
+
+int fevent_wait(fevent_t* ev) {
+	atomic_fetch_add(&ev->waiters, 1);
+	while (1) {
+		if (ev->manual) {
+			if (atomic_load(&ev->state)) break;
+		} else {
+			int set = 1;
+			if (atomic_compare_exchange_strong(&ev->state, &set, 0)) break;
+		}
+		futex_wait(&ev->state, 0, NULL, ev->private);
+	}
+	atomic_fetch_sub(&ev->waiters, 1);
+	return 0;
+}
+
+int fevent_set(fevent_t* ev) {
+	atomic_store(&ev->state, 1);
+	if (atomic_load(&ev->waiters) > 0)
+		futex_wake(&ev->state, ev->manual ? INT_MAX : 1, ev->private);
+	return 0;
+}
+
+int fevent_reset(fevent_t* ev) {
+	atomic_store(&ev->state, 0);
+	return 0;
+}
+
+/* Eventcount */
+
+int fec_init(fec_t* ec, int pshared) {
+	atomic_init(&ec->seq, 0);
+	atomic_init(&ec->waiters, 0);
+	ec->private = pshared ? 0 : FUTEX_PRIVATE_FLAG;
+	return 0;
+}
+
+unsigned int fec_prepare_wait(fec_t* ec) {
+	atomic_store(&ec->waiters, 1);
+	return atomic_load(&ec->seq);
+}
+
+// the flag is left set: at worst the next notify makes one useless system call
+void fec_cancel_wait(fec_t* ec) {
+	(void)ec;
+}
+
+// returns at the first notify after fec_prepare_wait() (or spuriously)
+void fec_wait(fec_t* ec, unsigned int key) {
+	while (atomic_load(&ec->seq) == key) {
+		if (futex_wait(&ec->seq, (int)key, NULL, ec->private) != EINTR) break;
+	}
+}
+
+/*
+ * To be called after the change the waiters are looking for has been
+ * published. The notifier that clears the flag wakes everybody, so a burst
+ * of notifies costs a single system call; waiters that still cannot make
+ * progress set the flag again.
+ */
+void fec_notify(fec_t* ec) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&ec->waiters, memory_order_relaxed) &&
+	    atomic_exchange(&ec->waiters, 0)) {
+		atomic_fetch_add(&ec->seq, 1);
+		futex_wake(&ec->seq, INT_MAX, ec->private);
+	}
+}
@@ -0,0 +1,82 @@
+#ifndef __FUTEX_SYNC__
+#define __FUTEX_SYNC__
+
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * Synchronization primitives built directly on futex(2). The uncontended
+ * paths are a single atomic operation in userspace; the kernel is entered
+ * only to sleep, and to wake someone only if a waiter has announced itself.
+ * Like sem_t, every object can live in shared memory (pshared != 0) to
+ * synchronize processes.
+ *
+ * fsem_t mirrors the sem_* API (0 on success, -1 and errno on failure), so
+ * it can replace an unnamed semaphore one call at a time. A waiter first
+ * spins for a while (fsem_set_spin(), default FSEM_SPIN) hoping for a post,
+ * then parks in the kernel.
+ */
+
+#ifndef FSEM_SPIN
+#define FSEM_SPIN	100	/* polls before parking, 0 parks at once */
+#endif
+
+typedef struct {
+	atomic_int value;
+	atomic_int waiters;	/* threads parked (or about to park) on value */
+	int spin;
+	int private;		/* FUTEX_PRIVATE_FLAG unless process-shared */
+} fsem_t;
+
+int fsem_init(fsem_t* s, int pshared, unsigned int value);
+int fsem_destroy(fsem_t* s);
+void fsem_set_spin(fsem_t* s, int spin);
+int fsem_wait(fsem_t* s);
+int fsem_trywait(fsem_t* s);
+int fsem_timedwait(fsem_t* s, const struct timespec* abstime);
+int fsem_post(fsem_t* s);
+int fsem_getvalue(fsem_t* s, int* sval);
+
+/*
+ * Event: fevent_set() wakes one waiter and clears the event (FEVENT_AUTO),
+ * or wakes everybody and stays set until fevent_reset() (FEVENT_MANUAL).
+ */
+
+#define FEVENT_AUTO	0
+#define FEVENT_MANUAL	1
+
+typedef struct {
+	atomic_int state;	/* 1 when set */
+	atomic_int waiters;
+	int manual;
+	int private;
+} fevent_t;
+
+int fevent_init(fevent_t* ev, int pshared, int manual, int set);
+int fevent_wait(fevent_t* ev);
+int fevent_set(fevent_t* ev);
+int fevent_reset(fevent_t* ev);
+
+/*
+ * Eventcount: lets a lock-free structure put its waiters to sleep without a
+ * lost wakeup. A waiter announces itself, checks its condition again and
+ * only then sleeps; a notifier that changed the condition enters the
+ * kernel only if somebody is announced.
+ *
+ *   key = fec_prepare_wait(ec);
+ *   if (condition holds) fec_cancel_wait(ec); else fec_wait(ec, key);
+ */
+
+typedef struct {
+	atomic_uint seq;
+	atomic_int waiters;	/* set while somebody may be asleep */
+	int private;
+} fec_t;
+
+int fec_init(fec_t* ec, int pshared);
+unsigned int fec_prepare_wait(fec_t* ec);
+void fec_cancel_wait(fec_t* ec);
+void fec_wait(fec_t* ec, unsigned int key);
+void fec_notify(fec_t* ec);
+
+#endif
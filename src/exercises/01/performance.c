@@ -1,5 +1,26 @@
 #include "performance.h"
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef PERF_USE_TSC
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#define CALIBRATION_NS		10000000	// 10 ms spent measuring the TSC frequency
+#define OVERHEAD_SAMPLES	1000
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static unsigned long int overhead_ns;	// cost of an empty begin()/end() pair
+#ifdef PERF_USE_TSC
+static int use_tsc;			// cleared at calibration if the TSC is not invariant
+static double ns_per_tick;
+#endif
+
+static __thread timer local_timer;
 
 struct timespec diff(struct timespec start, struct timespec end)
 {
@@ -14,27 +35,196 @@ struct timespec diff(struct timespec start, struct timespec end)
 	return temp;
 }
 
-void begin(timer* t) {
+static inline unsigned long int timespec_ns(struct timespec ts) {
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static inline void read_begin(timer* t) {
+#ifdef PERF_USE_TSC
+	if (use_tsc) {
+		_mm_lfence(); // do not let rdtsc run ahead of the preceding instructions
+		t->tsc = __rdtsc();
+		return;
+	}
+#endif
 	clock_gettime(CLOCK_MONOTONIC, &(t->begin));
 }
 
-void end(timer* t) {
+// uncompensated elapsed time since read_begin(), in ns
+static inline unsigned long int read_end(timer* t) {
+#ifdef PERF_USE_TSC
+	if (use_tsc) {
+		unsigned int aux;
+		unsigned long long now = __rdtscp(&aux); // waits for the measured code to complete
+		_mm_lfence();
+		return (unsigned long int)((now - t->tsc) * ns_per_tick);
+	}
+#endif
 	clock_gettime(CLOCK_MONOTONIC, &(t->end));
-	t->elapsed = diff(t->begin, t->end);
+	return timespec_ns(diff(t->begin, t->end));
+}
+
+#ifdef PERF_USE_TSC
+static int tsc_invariant() {
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return 0;
+	return (edx >> 8) & 1;
+}
+#endif
+
+static void calibrate() {
+#ifdef PERF_USE_TSC
+	use_tsc = tsc_invariant();
+	if (use_tsc) {
+		struct timespec c0, c1;
+		clock_gettime(CLOCK_MONOTONIC, &c0);
+		unsigned long long t0 = __rdtsc();
+		do {
+			clock_gettime(CLOCK_MONOTONIC, &c1);
+		} while (timespec_ns(diff(c0, c1)) < CALIBRATION_NS);
+		unsigned long long t1 = __rdtsc();
+		ns_per_tick = (double)timespec_ns(diff(c0, c1)) / (t1 - t0);
+	}
+#endif
+	// the cheapest empty measurement is the fixed cost end() has to subtract
+	timer t;
+	unsigned long int min = ULONG_MAX;
+	int i;
+	for (i = 0; i < OVERHEAD_SAMPLES; i++) {
+		read_begin(&t);
+		unsigned long int ns = read_end(&t);
+		if (ns < min) min = ns;
+	}
+	overhead_ns = min;
+}
+
+void perf_calibrate() {
+	pthread_once(&calibrate_once, calibrate);
+}
+
+unsigned long int perf_overhead() {
+	perf_calibrate();
+	return overhead_ns;
+}
+
+void begin(timer* t) {
+	perf_calibrate();
+	read_begin(t);
+}
+
+void end(timer* t) {
+	unsigned long int ns = read_end(t);
+	ns = ns > overhead_ns ? ns - overhead_ns : 0;
+	t->elapsed.tv_sec = ns / 1000000000;
+	t->elapsed.tv_nsec = ns % 1000000000;
+}
+
+unsigned long int now_ns() {
+	perf_calibrate();
+#ifdef PERF_USE_TSC
+	if (use_tsc) return (unsigned long int)(__rdtsc() * ns_per_tick);
+#endif
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_ns(ts);
+}
+
+void begin_local() {
+	begin(&local_timer);
+}
+
+unsigned long int end_local() {
+	end(&local_timer);
+	return get_nanoseconds(&local_timer);
 }
 
 unsigned long int get_nanoseconds(timer* t) {
-	return t->elapsed.tv_sec * 1000000000 + t->elapsed.tv_nsec;
+	return timespec_ns(t->elapsed);
 }
 
 unsigned long int get_microseconds(timer* t) {
-	return (unsigned int)round(get_nanoseconds(t)/1000);
+	return (get_nanoseconds(t) + 500) / 1000;
 }
 
 unsigned long int get_milliseconds(timer* t) {
-	return (unsigned int)round(get_nanoseconds(t)/1000000);
+	return (get_nanoseconds(t) + 500000) / 1000000;
 }
 
 unsigned long int get_seconds(timer* t) {
-	return (unsigned int)round(get_nanoseconds(t)/1000000000);
+	return (get_nanoseconds(t) + 500000000) / 1000000000;
+}
+
+void hist_init(histogram* h) {
+	memset(h, 0, sizeof(histogram));
+	h->min = ULONG_MAX;
+}
+
+int hist_bucket(unsigned long int v) {
+	if (v >= (1UL << HIST_MAX_BITS)) v = (1UL << HIST_MAX_BITS) - 1;
+	if (v < (1UL << HIST_SUB_BITS)) return (int)v;
+	int e = 63 - __builtin_clzl(v); // position of the most significant bit
+	return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (int)((v >> (e - HIST_SUB_BITS)) - (1UL << HIST_SUB_BITS));
+}
+
+// highest value that falls into bucket i
+unsigned long int hist_bucket_value(int i) {
+	if (i < (1 << HIST_SUB_BITS)) return i;
+	int shift = (i >> HIST_SUB_BITS) - 1;
+	unsigned long int sub = (i & ((1 << HIST_SUB_BITS) - 1)) + (1UL << HIST_SUB_BITS);
+	return ((sub + 1) << shift) - 1;
+}
+
+void hist_record(histogram* h, unsigned long int ns) {
+	h->buckets[hist_bucket(ns)]++;
+	h->count++;
+	h->sum += ns;
+	if (ns < h->min) h->min = ns;
+	if (ns > h->max) h->max = ns;
+}
+
+void hist_record_timer(histogram* h, timer* t) {
+	hist_record(h, get_nanoseconds(t));
+}
+
+void hist_merge(histogram* dst, const histogram* src) {
+	int i;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+// p is a percentage in [0, 100]
+unsigned long int hist_percentile(const histogram* h, double p) {
+	if (h->count == 0) return 0;
+	if (p >= 100.0) return h->max;
+
+	unsigned long int rank = (unsigned long int)ceil(p / 100.0 * h->count);
+	if (rank == 0) rank = 1;
+
+	unsigned long int seen = 0;
+	int i;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			unsigned long int v = hist_bucket_value(i);
+			if (v < h->min) return h->min;
+			if (v > h->max) return h->max;
+			return v;
+		}
+	}
+	return h->max;
+}
+
+void hist_print(const histogram* h, const char* label) {
+	if (h->count == 0) {
+		printf("%s: no samples\n", label);
+		return;
+	}
+	printf("%s: %lu samples, mean %lu ns\n", label, h->count, h->sum / h->count);
+	printf("  min %lu | p50 %lu | p90 %lu | p99 %lu | p99.9 %lu | max %lu (ns)\n",
+		h->min, hist_percentile(h, 50), hist_percentile(h, 90), hist_percentile(h, 99),
+		hist_percentile(h, 99.9), h->max);
 }
@@ -3,17 +3,62 @@
 
 #include <time.h>       /* time */
 
+/*
+ * Timers read CLOCK_MONOTONIC by default. Building with -DPERF_USE_TSC on
+ * x86-64 switches to the time stamp counter (rdtsc/rdtscp), converted to ns
+ * with a rate measured against CLOCK_MONOTONIC; if the CPU has no invariant
+ * TSC we silently fall back to the clock. Calibration runs once, on the
+ * first begin() or when perf_calibrate() is called at startup, and also
+ * measures the cost of an empty begin()/end() pair that end() subtracts.
+ */
 typedef struct {
 	struct timespec begin;
 	struct timespec end;
 	struct timespec elapsed;
+	unsigned long long tsc;	/* begin timestamp of the TSC backend */
 } timer;
 
+void perf_calibrate();
+unsigned long int perf_overhead();
 void begin(timer* t);
 void end(timer* t);
+unsigned long int now_ns();
+/* per-thread timer, for hot paths that cannot carry a timer around */
+void begin_local();
+unsigned long int end_local();
 unsigned long int get_seconds(timer* t);
 unsigned long int get_milliseconds(timer* t);
 unsigned long int get_microseconds(timer* t);
 unsigned long int get_nanoseconds(timer* t);
 
+/*
+ * Latency histogram with log-linear (HDR-style) buckets: every power of two
+ * is split into 2^HIST_SUB_BITS linear sub-buckets, so percentiles are exact
+ * up to a relative error of 1/2^HIST_SUB_BITS while memory stays fixed.
+ * A histogram is meant to be owned by a single thread: record into a private
+ * one and hist_merge() them after the join, no locking is needed.
+ */
+#define HIST_SUB_BITS	5
+#define HIST_MAX_BITS	40	/* values are clamped to 2^40 ns (~18 minutes) */
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+	unsigned long int count;
+	unsigned long int min;
+	unsigned long int max;
+	unsigned long int sum;
+	unsigned long int buckets[HIST_BUCKETS];
+} histogram;
+
+void hist_init(histogram* h);
+void hist_record(histogram* h, unsigned long int ns);
+void hist_record_timer(histogram* h, timer* t);
+void hist_merge(histogram* dst, const histogram* src);
+unsigned long int hist_percentile(const histogram* h, double p);
+void hist_print(const histogram* h, const char* label);
+
+/* bucket layout, for histograms kept elsewhere (e.g. atomic counters in shared memory) */
+int hist_bucket(unsigned long int ns);
+unsigned long int hist_bucket_value(int i);
+
 #endif
@@ -0,0 +1,64 @@
+#define _GNU_SOURCE	/* sched_getcpu */
+#include "sharded_counter.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static atomic_int next_thread_shard;
+static __thread int thread_shard = -1;
+
+// num_shards == 0 means one shard per configured CPU, as sched_getcpu() may return
+// any of them (not only the online ones); returns 0 or an error number
+int sc_init(sharded_counter* sc, int num_shards, int mode) {
+	if (num_shards <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_CONF);
+		num_shards = cpus > 0 ? (int)cpus : 1;
+	}
+	// round up to a power of two, so that picking a shard is a mask
+	int n = 1;
+	while (n < num_shards) n <<= 1;
+
+	sc->shards = aligned_alloc(SC_CACHE_LINE, n * sizeof(sc_shard));
+	if (sc->shards == NULL) return ENOMEM;
+	sc->num_shards = n;
+	sc->mode = mode;
+
+	int i;
+	for (i = 0; i < n; i++)
+		atomic_init(&sc->shards[i].value, 0);
+	return 0;
+}
+
+void sc_add(sharded_counter* sc, long int v) {
+	int shard;
+	if (sc->mode == SC_BY_THREAD) {
+		if (thread_shard < 0)
+			thread_shard = atomic_fetch_add_explicit(&next_thread_shard, 1, memory_order_relaxed);
+		shard = thread_shard;
+	} else {
+		shard = sched_getcpu();
+		if (shard < 0) shard = 0;
+	}
+	// still atomic: threads may share a shard, but only occasionally so
+	atomic_fetch_add_explicit(&sc->shards[shard & (sc->num_shards - 1)].value, v, memory_order_relaxed);
+}
+
+long int sc_sum(sharded_counter* sc) {
+	long int sum = 0;
+	int i;
+	for (i = 0; i < sc->num_shards; i++)
+		sum += atomic_load_explicit(&sc->shards[i].value, memory_order_relaxed);
+	return sum;
+}
+
+long int sc_quiesce_sum(sharded_counter* sc) {
+	// pairs with the synchronization that stopped the writers (join, semaphore...)
+	atomic_thread_fence(memory_order_acquire);
+	return sc_sum(sc);
+}
+
+void sc_destroy(sharded_counter* sc) {
+	free(sc->shards);
+	sc->shards = NULL;
+}
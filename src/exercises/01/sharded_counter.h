@@ -0,0 +1,37 @@
+#ifndef __SHARDED_COUNTER__
+#define __SHARDED_COUNTER__
+
+#include <stdatomic.h>
+
+/*
+ * Counter split into shards that live on separate cache lines. Writers add
+ * to the shard of the CPU they are running on (or to a shard assigned to
+ * their thread), so concurrent adds neither take a lock nor bounce a line
+ * between cores. Readers pay instead, by summing all the shards:
+ * - sc_sum() may miss adds that are running concurrently, but it never
+ *   blocks and every completed add eventually shows up;
+ * - sc_quiesce_sum() is exact once the writers have quiesced, e.g. after
+ *   they have been joined.
+ */
+#define SC_CACHE_LINE 64
+
+#define SC_BY_CPU	0	/* shard chosen with sched_getcpu() */
+#define SC_BY_THREAD	1	/* shard assigned round-robin to each thread */
+
+typedef struct {
+	_Alignas(SC_CACHE_LINE) atomic_long value;
+} sc_shard;
+
+typedef struct {
+	sc_shard* shards;
+	int num_shards;		/* a power of two */
+	int mode;
+} sharded_counter;
+
+int sc_init(sharded_counter* sc, int num_shards, int mode);
+void sc_add(sharded_counter* sc, long int v);
+long int sc_sum(sharded_counter* sc);
+long int sc_quiesce_sum(sharded_counter* sc);
+void sc_destroy(sharded_counter* sc);
+
+#endif
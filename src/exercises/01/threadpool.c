@@ -0,0 +1,126 @@
+#define _GNU_SOURCE	/* pthread_attr_setaffinity_np */
+#include "threadpool.h"
+#include <errno.h>
+#include <limits.h>	/* PTHREAD_STACK_MIN */
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define INITIAL_QUEUE_CAPACITY 64
+
+static void* worker(void* arg) {
+	thread_pool* tp = (thread_pool*)arg;
+
+	pthread_mutex_lock(&tp->lock);
+	while (1) {
+		while (tp->count == 0 && !tp->shutdown)
+			pthread_cond_wait(&tp->not_empty, &tp->lock);
+		if (tp->count == 0) break; // shutdown and nothing left to run
+
+		task_t task = tp->queue[tp->head];
+		tp->head = (tp->head + 1) % tp->capacity;
+		tp->count--;
+
+		pthread_mutex_unlock(&tp->lock);
+		task.fn(task.arg);
+		pthread_mutex_lock(&tp->lock);
+
+		if (--tp->pending == 0)
+			pthread_cond_broadcast(&tp->all_done);
+	}
+	pthread_mutex_unlock(&tp->lock);
+	return NULL;
+}
+
+int tp_init(thread_pool* tp, const tp_config* cfg) {
+	int ret = 0, i = 0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1) cpus = 1;
+
+	tp->num_workers = (cfg != NULL && cfg->num_workers > 0) ? cfg->num_workers : (int)cpus;
+	tp->capacity = INITIAL_QUEUE_CAPACITY;
+	tp->head = tp->count = tp->pending = tp->shutdown = 0;
+	pthread_mutex_init(&tp->lock, NULL);
+	pthread_cond_init(&tp->not_empty, NULL);
+	pthread_cond_init(&tp->all_done, NULL);
+
+	tp->queue = malloc(tp->capacity * sizeof(task_t));
+	tp->workers = malloc(tp->num_workers * sizeof(pthread_t));
+	if (tp->queue == NULL || tp->workers == NULL) {
+		tp->num_workers = 0; // nothing to join, tp_destroy() only frees
+		return ENOMEM;
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (cfg != NULL && cfg->stack_size > 0) {
+		size_t stack_min = (size_t)PTHREAD_STACK_MIN; // a long sysconf() value on recent glibc
+		size_t stack_size = cfg->stack_size < stack_min ? stack_min : cfg->stack_size;
+		if ((ret = pthread_attr_setstacksize(&attr, stack_size))) goto out;
+	}
+
+	for (i = 0; i < tp->num_workers; i++) {
+		if (cfg != NULL && cfg->pin) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(i % cpus, &set);
+			if ((ret = pthread_attr_setaffinity_np(&attr, sizeof(set), &set))) break;
+		}
+		if ((ret = pthread_create(&tp->workers[i], &attr, worker, tp))) break;
+	}
+out:
+	tp->num_workers = i; // on failure, let tp_destroy() join only the workers we started
+	pthread_attr_destroy(&attr);
+	return ret;
+}
+
+int tp_submit(thread_pool* tp, task_fn fn, void* arg) {
+	pthread_mutex_lock(&tp->lock);
+	if (tp->count == tp->capacity) {
+		// unroll the circular buffer into a queue twice as large
+		task_t* queue = malloc(2 * tp->capacity * sizeof(task_t));
+		if (queue == NULL) {
+			pthread_mutex_unlock(&tp->lock);
+			return ENOMEM;
+		}
+		int i;
+		for (i = 0; i < tp->count; i++)
+			queue[i] = tp->queue[(tp->head + i) % tp->capacity];
+		free(tp->queue);
+		tp->queue = queue;
+		tp->head = 0;
+		tp->capacity *= 2;
+	}
+	tp->queue[(tp->head + tp->count) % tp->capacity] = (task_t){ fn, arg };
+	tp->count++;
+	tp->pending++;
+	pthread_cond_signal(&tp->not_empty);
+	pthread_mutex_unlock(&tp->lock);
+	return 0;
+}
+
+// waits until every task submitted so far has completed
+void tp_wait(thread_pool* tp) {
+	pthread_mutex_lock(&tp->lock);
+	while (tp->pending > 0)
+		pthread_cond_wait(&tp->all_done, &tp->lock);
+	pthread_mutex_unlock(&tp->lock);
+}
+
+// runs the tasks still queued, then stops and joins the workers
+void tp_destroy(thread_pool* tp) {
+	int i;
+	pthread_mutex_lock(&tp->lock);
+	tp->shutdown = 1;
+	pthread_cond_broadcast(&tp->not_empty);
+	pthread_mutex_unlock(&tp->lock);
+
+	for (i = 0; i < tp->num_workers; i++)
+		pthread_join(tp->workers[i], NULL);
+
+	pthread_mutex_destroy(&tp->lock);
+	pthread_cond_destroy(&tp->not_empty);
+	pthread_cond_destroy(&tp->all_done);
+	free(tp->queue);
+	free(tp->workers);
+}
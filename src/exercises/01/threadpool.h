@@ -0,0 +1,44 @@
+#ifndef __THREADPOOL__
+#define __THREADPOOL__
+
+#include <pthread.h>
+#include <stddef.h>     /* size_t */
+
+/*
+ * Fixed-size pool of worker threads fed by a FIFO task queue. Creating the
+ * workers once and reusing them avoids paying pthread_create() and a fresh
+ * stack for every unit of work. The functions return 0 on success and an
+ * error number (as the pthread functions do) on failure.
+ */
+
+typedef void (*task_fn)(void* arg);
+
+typedef struct {
+	task_fn fn;
+	void* arg;
+} task_t;
+
+typedef struct {
+	int num_workers;	/* 0 means one worker per online CPU */
+	size_t stack_size;	/* 0 means the default stack size */
+	int pin;		/* if set, worker i is pinned to CPU i % CPUs */
+} tp_config;
+
+typedef struct {
+	pthread_t* workers;
+	int num_workers;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;	/* signaled when a task is queued or at shutdown */
+	pthread_cond_t all_done;	/* signaled when pending drops to zero */
+	task_t* queue;			/* circular buffer, grows when full */
+	int capacity, head, count;
+	int pending;			/* queued plus running tasks */
+	int shutdown;
+} thread_pool;
+
+int tp_init(thread_pool* tp, const tp_config* cfg);
+int tp_submit(thread_pool* tp, task_fn fn, void* arg);
+void tp_wait(thread_pool* tp);
+void tp_destroy(thread_pool* tp);
+
+#endif
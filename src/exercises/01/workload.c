@@ -0,0 +1,124 @@
+#include "workload.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// parses a time like "250us"; returns 0 or EINVAL
+static int parse_time(const char* s, char** end, long* ns) {
+	double v = strtod(s, end);
+	if (*end == s || v < 0) return EINVAL;
+	if (strncmp(*end, "ns", 2) == 0) *end += 2;
+	else if (strncmp(*end, "us", 2) == 0) { v *= 1e3; *end += 2; }
+	else if (strncmp(*end, "ms", 2) == 0) { v *= 1e6; *end += 2; }
+	else if (**end == 's') { v *= 1e9; *end += 1; }
+	*ns = (long)v;
+	return 0;
+}
+
+// fills cfg from a distribution string (see workload.h); returns 0 or EINVAL
+int wl_parse(wl_config* cfg, const char* spec) {
+	char* p;
+	memset(cfg, 0, sizeof(*cfg));
+
+	if (strncmp(spec, "zero", 4) == 0) {
+		cfg->dist = WL_ZERO;
+		p = (char*)spec + 4;
+	} else if (strncmp(spec, "fixed:", 6) == 0) {
+		cfg->dist = WL_FIXED;
+		if (parse_time(spec + 6, &p, &cfg->time_ns)) return EINVAL;
+	} else if (strncmp(spec, "exp:", 4) == 0) {
+		cfg->dist = WL_EXP;
+		if (parse_time(spec + 4, &p, &cfg->time_ns)) return EINVAL;
+	} else if (strncmp(spec, "bimodal:", 8) == 0) {
+		cfg->dist = WL_BIMODAL;
+		if (parse_time(spec + 8, &p, &cfg->time_ns) || *p != ':') return EINVAL;
+		if (parse_time(p + 1, &p, &cfg->slow_ns) || *p != ':') return EINVAL;
+		char* q = p + 1;
+		cfg->slow_prob = strtod(q, &p);
+		if (p == q || cfg->slow_prob < 0 || cfg->slow_prob > 1) return EINVAL;
+	} else {
+		return EINVAL;
+	}
+
+	if (strcmp(p, ",spin") == 0) cfg->spin = 1;
+	else if (*p != '\0') return EINVAL;
+	return 0;
+}
+
+// spec == NULL means the WORKLOAD environment variable, or WL_DEFAULT if unset
+int wl_config_init(wl_config* cfg, const char* spec) {
+	if (spec == NULL) spec = getenv("WORKLOAD");
+	if (spec == NULL || *spec == '\0') spec = WL_DEFAULT;
+	return wl_parse(cfg, spec);
+}
+
+// splitmix64 spreads nearby (seed, id) pairs over unrelated states
+void wl_seed(wl_rng* rng, uint64_t seed, int id) {
+	uint64_t z = seed + (uint64_t)(id + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	rng->state = z ? z : 0x9E3779B97F4A7C15ULL;	/* xorshift must not start from 0 */
+}
+
+uint64_t wl_next(wl_rng* rng) {
+	uint64_t x = rng->state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	rng->state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+// uniform in [0, 1)
+double wl_uniform(wl_rng* rng) {
+	return (wl_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void wl_init(workload* wl, const wl_config* cfg, uint64_t seed, int id) {
+	wl->cfg = *cfg;
+	wl_seed(&wl->rng, seed, id);
+}
+
+long wl_service_ns(workload* wl) {
+	switch (wl->cfg.dist) {
+	case WL_FIXED:
+		return wl->cfg.time_ns;
+	case WL_EXP:
+		return (long)(-wl->cfg.time_ns * log(1.0 - wl_uniform(&wl->rng)));
+	case WL_BIMODAL:
+		return wl_uniform(&wl->rng) < wl->cfg.slow_prob ? wl->cfg.slow_ns : wl->cfg.time_ns;
+	default:
+		return 0;
+	}
+}
+
+// draws a service time and sleeps (or spins) for it
+void wl_serve(workload* wl) {
+	long ns = wl_service_ns(wl);
+	if (ns <= 0) return;
+
+	if (wl->cfg.spin) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long deadline = now.tv_sec * 1000000000LL + now.tv_nsec + ns;
+		do {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		} while (now.tv_sec * 1000000000LL + now.tv_nsec < deadline);
+	} else {
+		struct timespec pause;
+		pause.tv_sec = ns / 1000000000;
+		pause.tv_nsec = ns % 1000000000;
+		while (nanosleep(&pause, &pause) == -1 && errno == EINTR)
+			;
+	}
+}
+
+// serves a transaction and returns its amount, in {-max, ..., -1} or {1, ..., max}
+int wl_transaction(workload* wl, int max) {
+	wl_serve(wl);
+	int amount = (int)(wl_next(&wl->rng) % (2 * (uint64_t)max));
+	return (amount >= max) ? (max - amount - 1) : (amount + 1);
+}
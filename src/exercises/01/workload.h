@@ -0,0 +1,59 @@
+#ifndef __WORKLOAD__
+#define __WORKLOAD__
+
+#include <stdint.h>
+
+/*
+ * Synthetic workload for the producers: a per-thread xorshift64* generator
+ * (no shared state, unlike rand()) seeded from (seed, producer id), and a
+ * service time drawn from a configurable distribution. The distribution is
+ * given as a string:
+ *
+ *   zero                       no service time
+ *   fixed:T                    always T
+ *   exp:T                      exponential with mean T
+ *   bimodal:FAST:SLOW:P        SLOW with probability P, FAST otherwise
+ *
+ * where times take an optional ns/us/ms/s suffix (default ns). Appending
+ * ",spin" busy-waits for the service time instead of sleeping, e.g.
+ * "exp:50us,spin". Programs without a command-line knob read the WORKLOAD
+ * environment variable.
+ */
+
+#define WL_ZERO		0
+#define WL_FIXED	1
+#define WL_EXP		2
+#define WL_BIMODAL	3
+
+#define WL_DEFAULT	"fixed:10ms"	/* the delay the exercises always had */
+
+typedef struct {
+	int dist;
+	long time_ns;		/* fixed time, mean, or fast mode of bimodal */
+	long slow_ns;		/* slow mode of bimodal */
+	double slow_prob;
+	int spin;		/* busy-wait instead of sleeping */
+} wl_config;
+
+typedef struct {
+	uint64_t state;
+} wl_rng;
+
+typedef struct {
+	wl_config cfg;
+	wl_rng rng;
+} workload;
+
+int wl_parse(wl_config* cfg, const char* spec);
+int wl_config_init(wl_config* cfg, const char* spec);
+void wl_init(workload* wl, const wl_config* cfg, uint64_t seed, int id);
+
+void wl_seed(wl_rng* rng, uint64_t seed, int id);
+uint64_t wl_next(wl_rng* rng);
+double wl_uniform(wl_rng* rng);
+
+long wl_service_ns(workload* wl);
+void wl_serve(workload* wl);
+int wl_transaction(workload* wl, int max);
+
+#endif
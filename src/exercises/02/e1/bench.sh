@@ -0,0 +1,17 @@
+#!/bin/bash
+# Throughput of the semaphore (glibc and futex), lock-free and batched queues as producers and consumers grow.
+# Transactions are produced with no delay, so the queue is the bottleneck.
+BENCH="../../bench/bench"
+PROG="producer_consumer"
+OPERATIONS=${OPERATIONS:-960000}
+
+if [ ! -f $PROG ]; then
+    echo "Did you forget to compile $PROG? Run make first :-)"
+    exit 1
+fi
+make -s -C ../../bench || exit 1
+
+$BENCH -r ${REPEATS:-3} -f csv -o queues.csv \
+    -p queue=sem,fsem,mpmc,batch -p producers=1,2,4,8 -p consumers=1,2,4,8 \
+    -- ./$PROG {queue} {producers} {consumers} $OPERATIONS zero
+echo "Results written to queues.csv (items/s = $OPERATIONS / wall_ns * 10^9)"
@@ -0,0 +1,285 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <errno.h>
+#include <sched.h>      // sched_yield()
+#include <stdatomic.h>
+#include <stdint.h>     // intptr_t
+#include <stdlib.h>
+#include "../../01/futex_sync.h"
+
+/*
+ * Bounded multi-producer multi-consumer queue of ints (Dmitry Vyukov's
+ * design). Every cell carries a sequence number that tells whether it is
+ * free for the producer holding ticket pos (seq == pos) or filled for the
+ * consumer holding ticket pos (seq == pos + 1). Producers and consumers
+ * claim tickets with a CAS on their own position counter and then touch
+ * only their cell, so there is no lock and a "try" operation fails only
+ * when the ring is really full (or empty). The blocking operations spin,
+ * then yield, and finally sleep on an eventcount, which the other side
+ * signals only when somebody is actually asleep.
+ */
+
+#define RING_CACHE_LINE     64
+#define RING_SPIN_LIMIT     128     // busy retries before yielding the CPU
+#define RING_YIELD_LIMIT    16      // yields before going to sleep
+#define RING_MAX_BATCH      64      // largest batch moved with a single CAS
+
+typedef struct {
+    atomic_size_t   seq;
+    int             value;
+} ring_cell_t;
+
+typedef struct {
+    ring_cell_t*    cells;
+    size_t          mask;
+    _Alignas(RING_CACHE_LINE) atomic_size_t enqueue_pos;
+    _Alignas(RING_CACHE_LINE) atomic_size_t dequeue_pos;
+    _Alignas(RING_CACHE_LINE) fec_t not_empty;  // consumers sleep here
+    _Alignas(RING_CACHE_LINE) fec_t not_full;   // producers sleep here
+} mpmc_ring_t;
+
+// capacity must be a power of two; returns 0 or an error number
+static inline int ring_init(mpmc_ring_t* r, size_t capacity) {
+    if (capacity < 2 || (capacity & (capacity - 1))) return EINVAL;
+    r->cells = malloc(capacity * sizeof(ring_cell_t));
+    if (r->cells == NULL) return ENOMEM;
+    r->mask = capacity - 1;
+    size_t i;
+    for (i = 0; i < capacity; i++)
+        atomic_init(&r->cells[i].seq, i);
+    atomic_init(&r->enqueue_pos, 0);
+    atomic_init(&r->dequeue_pos, 0);
+    fec_init(&r->not_empty, 0);
+    fec_init(&r->not_full, 0);
+    return 0;
+}
+
+static inline void ring_destroy(mpmc_ring_t* r) {
+    free(r->cells);
+}
+
+// returns 1 on success, 0 if the ring is full
+static inline int ring_try_enqueue(mpmc_ring_t* r, int value) {
+    size_t pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    while (1) {
+        ring_cell_t* cell = &r->cells[pos & r->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->enqueue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                cell->value = value;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                fec_notify(&r->not_empty);
+                return 1;
+            }
+            // another producer took the ticket, pos has been reloaded by the CAS
+        } else if (dif < 0) {
+            return 0; // the cell still holds the value of the previous lap
+        } else {
+            pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// returns 1 on success and stores the ticket of the item in *ticket, 0 if the ring is empty
+static inline int ring_try_dequeue(mpmc_ring_t* r, int* value, size_t* ticket) {
+    size_t pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+    while (1) {
+        ring_cell_t* cell = &r->cells[pos & r->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->dequeue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                *value = cell->value;
+                if (ticket != NULL) *ticket = pos;
+                // hand the cell over to the producer of the next lap
+                atomic_store_explicit(&cell->seq, pos + r->mask + 1, memory_order_release);
+                fec_notify(&r->not_full);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0; // nothing has been written in the cell yet
+        } else {
+            pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+/*
+ * Wait loop of the blocking operations, called each time the "try" fails:
+ * spin first, then yield, then announce ourselves on the eventcount (so
+ * that the next try is the last check before sleeping) and sleep on the
+ * following call. Yielding is cheap when the wait is short, sleeping stops
+ * burning CPU when it is long.
+ */
+typedef struct {
+    int spins;
+    int armed;
+    unsigned int key;
+} ring_waiter_t;
+
+static inline void ring_wait(ring_waiter_t* w, fec_t* ec) {
+    if (w->armed) {
+        fec_wait(ec, w->key);
+        w->armed = 0;
+        w->spins = 0;
+    } else if (++w->spins >= RING_SPIN_LIMIT + RING_YIELD_LIMIT) {
+        w->key = fec_prepare_wait(ec);
+        w->armed = 1;
+    } else if (w->spins >= RING_SPIN_LIMIT) {
+        sched_yield();
+    }
+}
+
+static inline void ring_wait_done(ring_waiter_t* w, fec_t* ec) {
+    if (w->armed) fec_cancel_wait(ec);
+}
+
+// blocking variants: they wait only while the ring is full (or empty)
+static inline void ring_enqueue(mpmc_ring_t* r, int value) {
+    ring_waiter_t w = {0};
+    while (!ring_try_enqueue(r, value))
+        ring_wait(&w, &r->not_full);
+    ring_wait_done(&w, &r->not_full);
+}
+
+static inline int ring_dequeue(mpmc_ring_t* r, size_t* ticket) {
+    int value;
+    ring_waiter_t w = {0};
+    while (!ring_try_dequeue(r, &value, ticket))
+        ring_wait(&w, &r->not_empty);
+    ring_wait_done(&w, &r->not_empty);
+    return value;
+}
+
+/*
+ * Batched operations: a producer reserves up to max consecutive free cells
+ * with one CAS, fills them and publishes them with ring_commit(); a consumer
+ * takes up to max consecutive filled cells with one CAS. Once a cell is seen
+ * free (or filled) it stays so until the owner of its ticket touches it, and
+ * the CAS makes us that owner, so checking the cells before the CAS is safe.
+ */
+
+// returns how many cells were reserved starting from ticket *first, 0 if the ring is full
+static inline size_t ring_reserve(mpmc_ring_t* r, size_t max, size_t* first) {
+    size_t pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    while (1) {
+        size_t count = 0;
+        while (count < max && atomic_load_explicit(&r->cells[(pos + count) & r->mask].seq,
+                                                   memory_order_acquire) == pos + count)
+            count++;
+        if (count == 0) {
+            size_t seq = atomic_load_explicit(&r->cells[pos & r->mask].seq, memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)pos < 0) return 0;
+            pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&r->enqueue_pos, &pos, pos + count,
+                memory_order_relaxed, memory_order_relaxed)) {
+            *first = pos;
+            return count;
+        }
+    }
+}
+
+static inline int* ring_slot(mpmc_ring_t* r, size_t ticket) {
+    return &r->cells[ticket & r->mask].value;
+}
+
+// makes the reserved cells visible to the consumers, in ticket order
+static inline void ring_commit(mpmc_ring_t* r, size_t first, size_t count) {
+    size_t i;
+    for (i = 0; i < count; i++)
+        atomic_store_explicit(&r->cells[(first + i) & r->mask].seq, first + i + 1, memory_order_release);
+    fec_notify(&r->not_empty);
+}
+
+// returns how many values were copied to values[] starting from ticket *first, 0 if the ring is empty
+static inline size_t ring_try_dequeue_batch(mpmc_ring_t* r, int* values, size_t max, size_t* first) {
+    size_t pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+    while (1) {
+        size_t count = 0;
+        while (count < max && atomic_load_explicit(&r->cells[(pos + count) & r->mask].seq,
+                                                   memory_order_acquire) == pos + count + 1)
+            count++;
+        if (count == 0) {
+            size_t seq = atomic_load_explicit(&r->cells[pos & r->mask].seq, memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) return 0;
+            pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&r->dequeue_pos, &pos, pos + count,
+                memory_order_relaxed, memory_order_relaxed)) {
+            size_t i;
+            for (i = 0; i < count; i++) {
+                ring_cell_t* cell = &r->cells[(pos + i) & r->mask];
+                values[i] = cell->value;
+                atomic_store_explicit(&cell->seq, pos + i + r->mask + 1, memory_order_release);
+            }
+            fec_notify(&r->not_full);
+            *first = pos;
+            return count;
+        }
+    }
+}
+
+// blocking variants: wait while the ring is full (or empty)
+static inline void ring_enqueue_batch(mpmc_ring_t* r, const int* values, size_t count) {
+    ring_waiter_t w = {0};
+    while (count > 0) {
+        size_t first, i, n = ring_reserve(r, count, &first);
+        if (n == 0) {
+            ring_wait(&w, &r->not_full);
+            continue;
+        }
+        for (i = 0; i < n; i++)
+            *ring_slot(r, first + i) = values[i];
+        ring_commit(r, first, n);
+        values += n;
+        count -= n;
+    }
+    ring_wait_done(&w, &r->not_full);
+}
+
+static inline size_t ring_dequeue_batch(mpmc_ring_t* r, int* values, size_t max, size_t* first) {
+    ring_waiter_t w = {0};
+    size_t n;
+    while ((n = ring_try_dequeue_batch(r, values, max, first)) == 0)
+        ring_wait(&w, &r->not_empty);
+    ring_wait_done(&w, &r->not_empty);
+    return n;
+}
+
+// approximate number of items in the ring
+static inline size_t ring_backlog(mpmc_ring_t* r) {
+    size_t head = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+/*
+ * Adaptive batch size: large batches amortize the CAS when there is a
+ * backlog, single items keep the latency low when the other side is idle.
+ */
+typedef struct {
+    size_t size;
+    size_t max;
+} ring_batch_t;
+
+static inline void ring_batch_init(ring_batch_t* b, size_t max) {
+    b->size = 1;
+    b->max = max > RING_MAX_BATCH ? RING_MAX_BATCH : max;
+}
+
+static inline void ring_batch_grow(ring_batch_t* b) {
+    if (b->size < b->max) b->size = (b->size * 2 > b->max) ? b->max : b->size * 2;
+}
+
+static inline void ring_batch_shrink(ring_batch_t* b) {
+    if (b->size > 1) b->size /= 2;
+}
+
+#endif
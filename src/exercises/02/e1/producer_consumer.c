@@ -3,17 +3,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
-#include <time.h>       // nanosleep()
 #include "common.h"
+#include "mpmc_ring.h"
+#include "../../01/performance.h"
+#include "../../01/sharded_counter.h"
+#include "../../01/async_log.h"
+#include "../../01/workload.h"
+#include "../../01/futex_sync.h"
 
+#ifndef BUFFER_SIZE
 #define BUFFER_SIZE         128
+#endif
 #define INITIAL_DEPOSIT     0
 #define MAX_TRANSACTION     1000
+#ifndef NUM_CONSUMERS
 #define NUM_CONSUMERS       2
+#endif
+#ifndef NUM_PRODUCERS
 #define NUM_PRODUCERS       4
+#endif
 #define PRNG_SEED           0
 
+#ifndef NUM_OPERATIONS
 #define NUM_OPERATIONS      400
+#endif
 #define OPS_PER_CONSUMER    (NUM_OPERATIONS/NUM_CONSUMERS)
 #define OPS_PER_PRODUCER    (NUM_OPERATIONS/NUM_PRODUCERS)
 
@@ -22,52 +35,141 @@
 #error "Choose NUM_CONSUMERS and NUM_PRODUCERS so that we get exactly NUM_OPERATIONS operations"
 #endif
 
+// how transactions travel from producers to consumers
+#define QUEUE_SEM           0   // ring guarded by the four semaphores e, s1, n, s2
+#define QUEUE_MPMC          1   // lock-free ring with per-slot sequence numbers
+#define QUEUE_BATCH         2   // lock-free ring, items moved in adaptive batches
+#define QUEUE_FSEM          3   // same as QUEUE_SEM with futex-based semaphores
+
 // struct used to specify arguments for a thread
 typedef struct {
     int threadId;
     int numOps;
+    workload wl;    // producers only: service times and amounts of this thread
 } thread_args_t;
 
 // shared data
 int transactions[BUFFER_SIZE];
-int deposit = INITIAL_DEPOSIT;
+sharded_counter deposit; // consumers add to it without holding s2
 int read_index, write_index;
 
 sem_t e, n;
 sem_t s1, s2;
+fsem_t fe, fn, fs1, fs2;
+
+// the sem and fsem queues run the same code on a different semaphore type
+#define SEM_WAIT(s)     (queue_mode == QUEUE_FSEM ? fsem_wait(&f##s) : sem_wait(&s))
+#define SEM_POST(s)     (queue_mode == QUEUE_FSEM ? fsem_post(&f##s) : sem_post(&s))
+
+mpmc_ring_t ring;
+
+const char* queue_names[] = { "sem", "mpmc", "batch", "fsem" };
+
+// parameters can be set also via command-line arguments
+int queue_mode = QUEUE_SEM;
+int num_producers = NUM_PRODUCERS, num_consumers = NUM_CONSUMERS, num_operations = NUM_OPERATIONS;
+wl_config workload_cfg;  // how long producing a transaction takes
 
 // generates a number between -MAX_TRANSACTION and +MAX_TRANSACTION
-static inline int performRandomTransaction() {
-    struct timespec pause = {0};
-    pause.tv_nsec = 10000000; // 10 ms (100*10^6 ns)
-    nanosleep(&pause, NULL);
+static inline int performRandomTransaction(thread_args_t* args) {
     //return 1; /** This permits to easily check the correctnes of the exercize **/ 
-    int amount = rand() % (2 * MAX_TRANSACTION); // {0, ..., 2*MAX_TRANSACTION - 1}
-    if (amount >= MAX_TRANSACTION) {
-        return MAX_TRANSACTION - (amount+1); // {-MAX_TRANSACTION, ..., -1}
-    } else { 
-        return amount + 1; // {1, ..., MAX_TRANSACTION}
+    return wl_transaction(&args->wl, MAX_TRANSACTION);
+}
+
+static inline void enqueueTransaction(int currentTransaction) {
+    if (queue_mode == QUEUE_MPMC) {
+        ring_enqueue(&ring, currentTransaction);
+        return;
+    }
+
+    if (SEM_WAIT(e)) handle_error("[producer] sem_wait error, sem e");      
+    if (SEM_WAIT(s1)) handle_error("[producer] sem_wait error, sem s1");     
+
+    // write the item and update write_index accordingly
+    transactions[write_index] = currentTransaction;
+    write_index = (write_index + 1) % BUFFER_SIZE;
+    
+    if (SEM_POST(s1)) handle_error("[producer] sem_post error, sem s1");      
+    if (SEM_POST(n)) handle_error("[producer] sem_post error, sem n");      
+}
+
+// also returns in *position how many items have gone through that slot of the ring
+static inline int dequeueTransaction(size_t* position) {
+    if (queue_mode == QUEUE_MPMC) {
+        int value = ring_dequeue(&ring, position);
+        (*position)++;
+        return value;
+    }
+
+    if (SEM_WAIT(n)) handle_error("[consumer] sem_wait error, sem n");       
+    if (SEM_WAIT(s2)) handle_error("[consumer] sem_wait error, sem s2");
+    
+    // consume the item and update read_index accordingly
+    int currentTransaction = transactions[read_index];
+    read_index = (read_index + 1) % BUFFER_SIZE;
+    *position = read_index;
+    
+    if (SEM_POST(s2)) handle_error("[consumer] sem_post error, sem s2");      
+    if (SEM_POST(e)) handle_error("[consumer] sem_post error, sem e");      
+    return currentTransaction;
+}
+
+// producer thread publishing its transactions in batches
+void performTransactionsBatched(thread_args_t* args) {
+    int batch[RING_MAX_BATCH], count = 0;
+    ring_batch_t size;
+    ring_batch_init(&size, RING_MAX_BATCH);
+
+    while (args->numOps > 0) {
+        batch[count++] = performRandomTransaction(args);
+        args->numOps--;
+        if (count < size.size && args->numOps > 0) continue;
+
+        // consumers waiting on an empty ring want items now, a backlog means they are behind anyway
+        size_t backlog = ring_backlog(&ring);
+        ring_enqueue_batch(&ring, batch, count);
+        if (backlog == 0) ring_batch_shrink(&size);
+        else if (backlog >= size.size) ring_batch_grow(&size);
+        count = 0;
+    }
+}
+
+// consumer thread draining the ring in batches
+void processTransactionsBatched(thread_args_t* args) {
+    int batch[RING_MAX_BATCH];
+    ring_batch_t size;
+    ring_batch_init(&size, RING_MAX_BATCH);
+
+    while (args->numOps > 0) {
+        size_t first, max = size.size < args->numOps ? size.size : args->numOps;
+        size_t i, count = ring_dequeue_batch(&ring, batch, max, &first);
+
+        long sum = 0;
+        for (i = 0; i < count; i++)
+            sum += batch[i];
+        sc_add(&deposit, sum);
+        // print if one of the tickets we got completes a group of 100 transactions
+        if ((first + count) / 100 != first / 100)
+            log_info("After the last 100 transactions balance is now about %ld.\n", sc_sum(&deposit));
+
+        if (count == max) ring_batch_grow(&size);
+        else if (count < max / 2) ring_batch_shrink(&size);
+        args->numOps -= count;
     }
 }
 
 // producer thread
 void* performTransactions(void* x) {
     thread_args_t* args = (thread_args_t*)x;
-    printf("Starting producer thread %d\n", args->threadId);
+    log_info("Starting producer thread %d\n", args->threadId);
+
+    if (queue_mode == QUEUE_BATCH) performTransactionsBatched(args);
 
     while (args->numOps > 0) {
         // produce the item
-        int currentTransaction = performRandomTransaction();
+        int currentTransaction = performRandomTransaction(args);
         
-        if (sem_wait(&e)) handle_error("[producer] sem_wait error, sem e");      
-        if (sem_wait(&s1)) handle_error("[producer] sem_wait error, sem s1");     
-
-        // write the item and update write_index accordingly
-        transactions[write_index] = currentTransaction;
-        write_index = (write_index + 1) % BUFFER_SIZE;
-        
-        if (sem_post(&s1)) handle_error("[producer] sem_post error, sem s1");      
-        if (sem_post(&n)) handle_error("[producer] sem_post error, sem n");      
+        enqueueTransaction(currentTransaction);
 
         args->numOps--;
         //printf("P %d\n", args->numOps);
@@ -80,21 +182,19 @@ void* performTransactions(void* x) {
 void* processTransactions(void* x) {      
     
     thread_args_t* args = (thread_args_t*)x;
-    printf("Starting consumer thread %d\n", args->threadId);
+    log_info("Starting consumer thread %d\n", args->threadId);
+
+    if (queue_mode == QUEUE_BATCH) processTransactionsBatched(args);
 
     while (args->numOps > 0) {
         
-        if (sem_wait(&n)) handle_error("[consumer] sem_wait error, sem n");       
-        if (sem_wait(&s2)) handle_error("[consumer] sem_wait error, sem s2");
+        size_t position;
+        int currentTransaction = dequeueTransaction(&position);
         
-        // consume the item and update (shared) variable deposit
-        deposit += transactions[read_index];
-        read_index = (read_index + 1) % BUFFER_SIZE;
-        if (read_index % 100 == 0)
-			printf("After the last 100 transactions balance is now %d.\n", deposit);
-        
-        if (sem_post(&s2)) handle_error("[consumer] sem_post error, sem s2");      
-        if (sem_post(&e)) handle_error("[consumer] sem_post error, sem e");      
+        // update the balance outside of the critical section
+        sc_add(&deposit, currentTransaction);
+        if (position % 100 == 0)
+			log_info("After the last 100 transactions balance is now about %ld.\n", sc_sum(&deposit));
         
         args->numOps--;
         //printf("C %d\n", args->numOps);
@@ -106,64 +206,119 @@ void* processTransactions(void* x) {
 
 int main(int argc, char* argv[]) {
     
+    // usage: producer_consumer [sem|fsem|mpmc|batch] [producers] [consumers] [operations] [workload]
+    // where workload is e.g. zero, fixed:10ms, exp:1ms (see workload.h), default $WORKLOAD or fixed:10ms
+    if (argc > 1) {
+        if (strcmp(argv[1], "sem") == 0) queue_mode = QUEUE_SEM;
+        else if (strcmp(argv[1], "mpmc") == 0) queue_mode = QUEUE_MPMC;
+        else if (strcmp(argv[1], "batch") == 0) queue_mode = QUEUE_BATCH;
+        else if (strcmp(argv[1], "fsem") == 0) queue_mode = QUEUE_FSEM;
+        else { fprintf(stderr, "Unknown queue %s, use sem, fsem, mpmc or batch\n", argv[1]); exit(EXIT_FAILURE); }
+    }
+    if (argc > 2) num_producers = atoi(argv[2]);
+    if (argc > 3) num_consumers = atoi(argv[3]);
+    if (argc > 4) num_operations = atoi(argv[4]);
+    if (wl_config_init(&workload_cfg, argc > 5 ? argv[5] : NULL)) {
+        fprintf(stderr, "Invalid workload %s\n", argc > 5 ? argv[5] : getenv("WORKLOAD"));
+        exit(EXIT_FAILURE);
+    }
+    if (num_producers <= 0 || num_consumers <= 0 || num_operations % num_producers || num_operations % num_consumers) {
+        fprintf(stderr, "Choose the number of consumers and producers so that we get exactly %d operations\n", num_operations);
+        exit(EXIT_FAILURE);
+    }
+    
     printf("Welcome! This program simulates financial transactions on a deposit.\n");
     printf("\nThe maximum amount of a single transaction is %d (negative or positive).\n", MAX_TRANSACTION);
     printf("\nInitial balance is %d. Press CTRL+C to quit.\n\n", INITIAL_DEPOSIT);
+    fflush(stdout);
+    int ret;
+
+    // threads log through a background writer, so printing does not stall them
+    ret = log_init();
+    if (ret) handle_error_en(ret, "log_init error");
 
     // initialize read and write indexes
     read_index  = 0;
     write_index = 0;
     
+    if (sc_init(&deposit, 0, SC_BY_CPU)) handle_error("sc_init error, deposit");
+    sc_add(&deposit, INITIAL_DEPOSIT);
+    
     if (sem_init(&n, 0, 0)) handle_error("sem_init error, sem n");
     if (sem_init(&e, 0, BUFFER_SIZE)) handle_error("sem_init error, sem e");
     if (sem_init(&s1, 0, 1)) handle_error("sem_init error, sem s1");
     if (sem_init(&s2, 0, 1)) handle_error("sem_init error, sem s2");
+    if (fsem_init(&fn, 0, 0)) handle_error("fsem_init error, sem n");
+    if (fsem_init(&fe, 0, BUFFER_SIZE)) handle_error("fsem_init error, sem e");
+    if (fsem_init(&fs1, 0, 1)) handle_error("fsem_init error, sem s1");
+    if (fsem_init(&fs2, 0, 1)) handle_error("fsem_init error, sem s2");
+    
+    // the semaphore modes use buffer, only the lock-free ones need the ring
+    int use_ring = queue_mode == QUEUE_MPMC || queue_mode == QUEUE_BATCH;
+    if (use_ring) {
+        ret = ring_init(&ring, BUFFER_SIZE);
+        if (ret) handle_error_en(ret, "ring_init error, BUFFER_SIZE must be a power of two");
+    }
 
-    // set seed for pseudo-random number generator: we use this to make
-    // this code yield the same result across different runs, as long
-    // as they are race-free and you make no mistakes :-)
-    srand(PRNG_SEED); 
-
-    int ret;
-    pthread_t producer[NUM_PRODUCERS], consumer[NUM_CONSUMERS];
+    pthread_t* producer = malloc(num_producers * sizeof(pthread_t));
+    pthread_t* consumer = malloc(num_consumers * sizeof(pthread_t));
+    timer t;
+    begin(&t);
 
     int i;
-    for (i=0; i<NUM_PRODUCERS; ++i) {
+    for (i=0; i<num_producers; ++i) {
         thread_args_t* arg = malloc(sizeof(thread_args_t));
         arg->threadId = i;
-        arg->numOps = OPS_PER_PRODUCER;
+        arg->numOps = num_operations / num_producers;
+        // each producer has its own generator seeded from PRNG_SEED and its id: this
+        // makes the code yield the same result across different runs, as long
+        // as it is race-free and you make no mistakes :-)
+        wl_init(&arg->wl, &workload_cfg, PRNG_SEED, i);
 
         ret = pthread_create(&producer[i], NULL, performTransactions, arg);
         if (ret != 0) { fprintf(stderr, "Error %d in pthread_create\n", ret); exit(EXIT_FAILURE); }
     }
 
     int j;
-    for (j=0; j<NUM_CONSUMERS; ++j) {
+    for (j=0; j<num_consumers; ++j) {
         thread_args_t* arg = malloc(sizeof(thread_args_t));
         arg->threadId = j;
-        arg->numOps = OPS_PER_CONSUMER;
+        arg->numOps = num_operations / num_consumers;
 
         ret = pthread_create(&consumer[j], NULL, processTransactions, arg);
         if (ret != 0) { fprintf(stderr, "Error %d in pthread_create\n", ret); exit(EXIT_FAILURE); }
     }
 
     // join on threads
-    for (i=0; i<NUM_PRODUCERS; ++i) {
+    for (i=0; i<num_producers; ++i) {
         ret = pthread_join(producer[i], NULL);
         if (ret != 0) { fprintf(stderr, "Error %d in pthread_join\n", ret); exit(EXIT_FAILURE); }
     }
 
-    for (j=0; j<NUM_CONSUMERS; ++j) {
+    for (j=0; j<num_consumers; ++j) {
         ret = pthread_join(consumer[j], NULL);
         if (ret != 0) { fprintf(stderr, "Error %d in pthread_join\n", ret); exit(EXIT_FAILURE); }
     }
+    end(&t);
+    log_shutdown();
 
-    printf("Final value for deposit: %d\n", deposit);
+    printf("Final value for deposit: %ld\n", sc_quiesce_sum(&deposit));
+    printf("Throughput: %.0f items/s (%d items in %lu ms, %s queue)\n",
+           num_operations * 1e9 / get_nanoseconds(&t), num_operations, get_milliseconds(&t),
+           queue_names[queue_mode]);
+    sc_destroy(&deposit);
+    if (use_ring) ring_destroy(&ring);
+    free(producer);
+    free(consumer);
     
     if (sem_destroy(&n)) handle_error("sem_destroy error, sem n");
     if (sem_destroy(&e)) handle_error("sem_destroy error, sem e");
     if (sem_destroy(&s1)) handle_error("sem_destroy error, sem s1");
     if (sem_destroy(&s2)) handle_error("sem_destroy error, sem s2");
+    fsem_destroy(&fn);
+    fsem_destroy(&fe);
+    fsem_destroy(&fs1);
+    fsem_destroy(&fs2);
 
     exit(EXIT_SUCCESS);
 }
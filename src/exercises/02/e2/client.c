@@ -1,6 +1,11 @@
 #include "util.h"
+#include "stats.h"
+#include "fcfs.h"
+#include "../../01/threadpool.h"
+#include "../../01/workload.h"
 
 #include <errno.h>
+#include <math.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdio.h>
@@ -10,52 +15,77 @@
 #include <unistd.h>
 
 #define MAX_SLEEP           6
+#define PRNG_SEED           0
 #define THREAD_BURST        5
 #define SEMAPHORE_NAME      "/simple_scheduler"
 
+// defaults of the open-loop mode
+#define OPEN_LOOP_RATE      20          // requests per second
+#define OPEN_LOOP_DURATION  10          // seconds
+#define OPEN_LOOP_WORKERS   16
+#define OPEN_LOOP_HOLD      "exp:100ms" // time a resource is held, see ../../01/workload.h
+
 typedef struct thread_args_s {
     int     ID;
 } thread_args_t;
 
+// statistics block of the server, shared by all the threads
+sched_stats_t* stats;
+
+// FCFS scheduler of the server, NULL if it uses the named semaphore
+fcfs_t* fcfs;
+
 void* client(void *arg_ptr) {
     char errorStr[100];
     thread_args_t* args = (thread_args_t*) arg_ptr;
+    sem_t* my_named_semaphore = NULL;
 
-    /** Open an existing named semaphore.
-     *
-     * For this operation, we can use the short version of sem_open
-     * that takes only two parameters, namely the identifier for
-     * the semaphore and the desired flags (0 in this scenario).
-     **/
+    if (fcfs == NULL) {
+        /** Open an existing named semaphore.
+         *
+         * For this operation, we can use the short version of sem_open
+         * that takes only two parameters, namely the identifier for
+         * the semaphore and the desired flags (0 in this scenario).
+         **/
 
-    sem_t* my_named_semaphore = sem_open(SEMAPHORE_NAME, 0);
+        my_named_semaphore = sem_open(SEMAPHORE_NAME, 0);
 
-    if (my_named_semaphore == SEM_FAILED) {
-        snprintf(errorStr, sizeof(errorStr), "Could not open the named semaphore from thread %d", args->ID);
-        handle_error(errorStr);
+        if (my_named_semaphore == SEM_FAILED) {
+            snprintf(errorStr, sizeof(errorStr), "Could not open the named semaphore from thread %d", args->ID);
+            handle_error(errorStr);
+        }
     }
 
     /*** Acquire the resource ***/
-    if (sem_wait(my_named_semaphore)) {
+    unsigned long wait_start = statsWaitBegin(stats);
+    if (fcfs != NULL) {
+        unsigned int ticket = fcfsAcquire(fcfs);
+        printf("[@Thread%d] Ticket %u served...\n", args->ID, ticket);
+    } else if (sem_wait(my_named_semaphore)) {
         snprintf(errorStr, sizeof(errorStr), "Could not lock the semaphore from thread %d", args->ID);
         handle_error(errorStr);
     }
 
-    printf("[@Thread%d] Resource acquired...\n", args->ID);
+    unsigned long acquired_at = statsWaitEnd(stats, wait_start);
+
+    printf("[@Thread%d] Resource acquired after %.1f ms...\n", args->ID, (acquired_at - wait_start) / 1e6);
 
     // we simulate some work by sleeping for 0 up to MAX_SLEEP seconds
     sleep(rand() % (MAX_SLEEP+1));
 
     /*** Free the resource ***/
-    if (sem_post(my_named_semaphore)) {
+    if (fcfs != NULL) {
+        fcfsRelease(fcfs);
+    } else if (sem_post(my_named_semaphore)) {
         snprintf(errorStr, sizeof(errorStr), "Could not unlock the semaphore from thread %d", args->ID);
         handle_error(errorStr);
     }
+    statsRelease(stats, acquired_at);
 
     printf("[@Thread%d] Done. Resource released!\n", args->ID);
 
     /*** Close the named semaphore ***/
-    if (sem_close(my_named_semaphore)) {
+    if (my_named_semaphore != NULL && sem_close(my_named_semaphore)) {
         snprintf(errorStr, sizeof(errorStr), "Could not close the semaphore from thread %d", args->ID);
         handle_error(errorStr);
     }
@@ -64,6 +94,113 @@ void* client(void *arg_ptr) {
     pthread_exit(NULL);
 }
 
+/** Open-loop mode
+ *
+ * Requests arrive at a given rate whether or not the previous ones have
+ * been served, as they would from independent users, and are handed to a
+ * fixed set of workers sharing one scheduler handle. The latency of a
+ * request is measured from its arrival, so the time spent queueing for a
+ * worker counts as well.
+ **/
+
+typedef struct request_s {
+    unsigned long arrival;      // now_ns() at the scheduled arrival time
+} request_t;
+
+sem_t* shared_semaphore;
+wl_config hold_cfg;
+histogram* latencies;           // one per worker, merged at the end
+atomic_int next_worker;
+atomic_ulong completed;
+
+void serveRequest(void* arg) {
+    static __thread int worker = -1;
+    static __thread workload hold;
+    request_t* req = (request_t*)arg;
+
+    if (worker < 0) {
+        worker = atomic_fetch_add(&next_worker, 1);
+        wl_init(&hold, &hold_cfg, PRNG_SEED, worker);
+    }
+
+    unsigned long wait_start = statsWaitBegin(stats);
+    if (fcfs != NULL) fcfsAcquire(fcfs);
+    else if (sem_wait(shared_semaphore)) handle_error("Could not lock the semaphore");
+    unsigned long acquired_at = statsWaitEnd(stats, wait_start);
+    hist_record(&latencies[worker], acquired_at - req->arrival);
+
+    wl_serve(&hold);
+
+    if (fcfs != NULL) fcfsRelease(fcfs);
+    else if (sem_post(shared_semaphore)) handle_error("Could not unlock the semaphore");
+    statsRelease(stats, acquired_at);
+
+    atomic_fetch_add(&completed, 1);
+    free(req);
+}
+
+void openLoop(double rate, int duration, int workers, int poisson) {
+    thread_pool pool;
+    tp_config cfg = { workers, 0, 0 };
+    int i, ret;
+
+    if (fcfs == NULL) {
+        shared_semaphore = sem_open(SEMAPHORE_NAME, 0);
+        if (shared_semaphore == SEM_FAILED) handle_error("Could not open the named semaphore");
+    }
+
+    latencies = malloc(workers * sizeof(histogram));
+    if (latencies == NULL) handle_error("Could not allocate the histograms");
+    for (i = 0; i < workers; i++)
+        hist_init(&latencies[i]);
+
+    ret = tp_init(&pool, &cfg);
+    if (ret) handle_error_en(ret, "Could not create the workers");
+
+    printf("[DRIVER] %s arrivals at %.1f requests/s for %d s, %d workers\n",
+           poisson ? "Poisson" : "Constant", rate, duration, workers);
+
+    // arrival times are scheduled in advance, so a late wakeup does not lower the rate
+    wl_rng arrivals;
+    wl_seed(&arrivals, PRNG_SEED, -1);
+    unsigned long start = now_ns(), end = start + duration * 1000000000UL, next = start;
+    unsigned long issued = 0;
+    while (next < end) {
+        unsigned long now = now_ns();
+        if (next > now) {
+            struct timespec pause = { (next - now) / 1000000000, (next - now) % 1000000000 };
+            nanosleep(&pause, NULL);
+        }
+
+        request_t* req = malloc(sizeof(request_t));
+        if (req == NULL) handle_error("Could not allocate a request");
+        req->arrival = next;
+        ret = tp_submit(&pool, serveRequest, req);
+        if (ret) handle_error_en(ret, "Could not submit a request");
+        issued++;
+
+        double gap = poisson ? -log(1.0 - wl_uniform(&arrivals)) / rate : 1.0 / rate;
+        next += (unsigned long)(gap * 1e9);
+    }
+
+    // let the backlog drain: what is still queued counts towards the latency
+    tp_wait(&pool);
+    unsigned long elapsed = now_ns() - start;
+    tp_destroy(&pool);
+
+    histogram total;
+    hist_init(&total);
+    for (i = 0; i < workers; i++)
+        hist_merge(&total, &latencies[i]);
+
+    printf("[DRIVER] %lu requests issued, %lu completed in %.2f s: %.1f requests/s\n",
+           issued, atomic_load(&completed), elapsed / 1e9, atomic_load(&completed) * 1e9 / elapsed);
+    hist_print(&total, "Acquisition latency (from arrival)");
+
+    free(latencies);
+    if (fcfs == NULL && sem_close(shared_semaphore)) handle_error("Could not close the named semaphore");
+}
+
 int main(int argc, char* argv[]) {
     char errorStr[100];
     int thread_ID = 0;
@@ -71,6 +208,29 @@ int main(int argc, char* argv[]) {
     printf("Welcome! This is a simple client for our FCFS scheduler.\n\n");
     printf("Please make sure that the server is already running in a separate terminal.\n\n");
 
+    stats = openStats();
+    fcfs = fcfsOpen();
+
+    // usage: client [rate [duration [workers [poisson|constant [hold]]]]]
+    // with no arguments, threads are spawned interactively
+    if (argc > 1) {
+        double rate = atof(argv[1]);
+        int duration = argc > 2 ? atoi(argv[2]) : OPEN_LOOP_DURATION;
+        int workers = argc > 3 ? atoi(argv[3]) : OPEN_LOOP_WORKERS;
+        int poisson = argc > 4 ? strcmp(argv[4], "constant") != 0 : 1;
+        if (rate <= 0) rate = OPEN_LOOP_RATE;
+        if (duration <= 0 || workers <= 0) {
+            fprintf(stderr, "Duration and workers must be positive\n");
+            exit(EXIT_FAILURE);
+        }
+        if (wl_parse(&hold_cfg, argc > 5 ? argv[5] : OPEN_LOOP_HOLD)) handle_error_en(EINVAL, "Invalid hold time");
+
+        openLoop(rate, duration, workers, poisson);
+        if (fcfs != NULL) fcfsClose(fcfs);
+        closeStats(stats);
+        exit(EXIT_SUCCESS);
+    }
+
     /* Main loop */
     printf("[DRIVER] Press ENTER to spawn %d new threads. Press CTRL+D to quit!\n", THREAD_BURST);
 
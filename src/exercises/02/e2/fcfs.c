@@ -0,0 +1,91 @@
+#include "fcfs.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+fcfs_t* fcfsCreate(int resources) {
+    shm_unlink(FCFS_NAME);
+    int fd = shm_open(FCFS_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) handle_error("[server] shm_open error, fcfs");
+    if (ftruncate(fd, sizeof(fcfs_t))) handle_error("[server] ftruncate error, fcfs");
+
+    fcfs_t* f = mmap(NULL, sizeof(fcfs_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (f == MAP_FAILED) handle_error("[server] mmap error, fcfs");
+    close(fd);
+
+    atomic_init(&f->next_ticket, 0);
+    atomic_init(&f->serving, resources); // the first tickets find a free resource
+    f->resources = resources;
+    int i;
+    for (i = 0; i < FCFS_SLOTS; i++)
+        fec_init(&f->slots[i].ec, 1);
+    return f;
+}
+
+void fcfsDestroy(fcfs_t* f) {
+    if (munmap(f, sizeof(fcfs_t))) handle_error("[server] munmap error, fcfs");
+    if (shm_unlink(FCFS_NAME)) handle_error("[server] shm_unlink error, fcfs");
+}
+
+fcfs_t* fcfsOpen() {
+    int fd = shm_open(FCFS_NAME, O_RDWR, 0);
+    if (fd == -1) {
+        if (errno == ENOENT) return NULL;
+        handle_error("Could not open the FCFS scheduler");
+    }
+
+    fcfs_t* f = mmap(NULL, sizeof(fcfs_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (f == MAP_FAILED) handle_error("Could not map the FCFS scheduler");
+    close(fd);
+    return f;
+}
+
+void fcfsClose(fcfs_t* f) {
+    if (munmap(f, sizeof(fcfs_t))) handle_error("Could not unmap the FCFS scheduler");
+}
+
+static inline int admitted(fcfs_t* f, unsigned int ticket) {
+    // signed difference, so that the counters may wrap around
+    return (int)(ticket - atomic_load(&f->serving)) < 0;
+}
+
+// blocks until a resource is ours, returns our ticket
+unsigned int fcfsAcquire(fcfs_t* f) {
+    unsigned int ticket = atomic_fetch_add(&f->next_ticket, 1);
+    int i;
+    for (i = 0; i < FCFS_SPIN; i++) {
+        if (admitted(f, ticket)) return ticket;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    fec_t* ec = &f->slots[ticket % FCFS_SLOTS].ec;
+    while (1) {
+        unsigned int key = fec_prepare_wait(ec);
+        if (admitted(f, ticket)) {
+            fec_cancel_wait(ec);
+            return ticket;
+        }
+        fec_wait(ec, key);
+    }
+}
+
+void fcfsRelease(fcfs_t* f) {
+    unsigned int next = atomic_fetch_add(&f->serving, 1); // this ticket is admitted now
+    fec_notify(&f->slots[next % FCFS_SLOTS].ec);
+}
+
+void fcfsUsage(fcfs_t* f, int* in_use, int* waiting) {
+    unsigned int serving = atomic_load(&f->serving);
+    unsigned int next = atomic_load(&f->next_ticket);
+    int queued = (int)(next - serving);
+    *waiting = queued > 0 ? queued : 0;
+    *in_use = f->resources + (queued < 0 ? queued : 0);
+}
@@ -0,0 +1,47 @@
+#ifndef FCFS_H
+#define FCFS_H
+
+#include <stdatomic.h>
+
+#include "../../01/futex_sync.h"
+
+#define FCFS_NAME           "/fcfs_scheduler"
+#define FCFS_SLOTS          256     // waiters beyond this share a slot, and wake up a bit more often
+#define FCFS_SPIN           100     // polls before sleeping
+
+/* First-come first-served allocation of a pool of resources among
+ * processes, kept in shared memory. A client takes a ticket, and ticket t
+ * may hold a resource once t < serving; every release admits the next
+ * ticket. Tickets are admitted strictly in order, and a client arriving
+ * while a resource is free gets it with a single atomic add. A client
+ * that has to wait sleeps on the eventcount of its slot (t % FCFS_SLOTS),
+ * which a release signals only if its client is actually asleep.
+ * Tickets are not owned by anybody the scheduler could check on: a client
+ * killed while it waits keeps its place in the queue, and when its ticket
+ * is admitted the resource is never released. As with a client killed
+ * while it holds the semaphore, that resource is lost until the server is
+ * restarted; the server's report shows it as in use with nobody holding it. */
+typedef struct fcfs_slot_s {
+    _Alignas(64) fec_t ec;
+} fcfs_slot_t;
+
+typedef struct fcfs_s {
+    _Alignas(64) atomic_uint next_ticket;
+    _Alignas(64) atomic_uint serving;
+    int resources;
+    fcfs_slot_t slots[FCFS_SLOTS];
+} fcfs_t;
+
+// server side
+fcfs_t* fcfsCreate(int resources);
+void fcfsDestroy(fcfs_t* f);
+
+// client side: fcfsOpen returns NULL if the server does not run the FCFS scheduler
+fcfs_t* fcfsOpen();
+void fcfsClose(fcfs_t* f);
+
+unsigned int fcfsAcquire(fcfs_t* f);
+void fcfsRelease(fcfs_t* f);
+void fcfsUsage(fcfs_t* f, int* in_use, int* waiting);
+
+#endif
@@ -1,4 +1,6 @@
 #include "util.h"
+#include "stats.h"
+#include "fcfs.h"
 
 #include <errno.h>
 #include <fcntl.h>  // O_CREAT and O_EXCL flags
@@ -6,18 +8,49 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>   // shm_unlink
 #include <time.h>
 #include <unistd.h>
 
-#define LOG_INTERVAL        1
+#define LOG_INTERVAL        250     // ms between two reports, can be set via command-line argument
 #define NUM_RESOURCES       3
 #define SEMAPHORE_NAME      "/simple_scheduler"
 
 // we use a global variable to store the pointer to the named semaphore
 sem_t* named_semaphore;
 
+// ...or to the FCFS scheduler, which the clients use if it exists (default)
+fcfs_t* fcfs;
+
+// statistics updated by the clients, and what the server saw at its last report
+sched_stats_t* stats;
+unsigned long last_wait[HIST_BUCKETS], last_hold[HIST_BUCKETS];
+histogram wait_interval, wait_total, hold_interval, hold_total;
+
+static double toMilliseconds(unsigned long ns) {
+    return ns / 1e6;
+}
+
+void printTotals() {
+    statsSnapshot(stats->wait_hist, last_wait, &wait_interval, &wait_total);
+    statsSnapshot(stats->hold_hist, last_hold, &hold_interval, &hold_total);
+    wait_total.sum = atomic_load(&stats->wait_sum);
+    hold_total.sum = atomic_load(&stats->hold_sum);
+
+    printf("%lu acquisitions, %lu releases\n", atomic_load(&stats->acquisitions), atomic_load(&stats->releases));
+    hist_print(&wait_total, "Wait time");
+    hist_print(&hold_total, "Hold time");
+}
+
 void cleanup() {
     printf("\rShutting down the server...\n");
+    if (fcfs != NULL) {
+        fcfsDestroy(fcfs);
+        printTotals();
+        destroyStats(stats);
+        exit(0);
+    }
+
     /** Remove the named semaphore.
      *
      * After closing the semaphore, the server process is responsible
@@ -33,11 +66,20 @@ void cleanup() {
 
     if (sem_unlink(SEMAPHORE_NAME)) handle_error(errormsg);
 
+    printTotals();
+    destroyStats(stats);
+
     exit(0);
 }
 
 int main(int argc, char* argv[]) {
     int ret;
+    int log_interval = LOG_INTERVAL;
+    if (argc > 1) log_interval = atoi(argv[1]);
+    if (log_interval <= 0) log_interval = LOG_INTERVAL;
+
+    // usage: server [log_interval_ms] [fcfs|sem]
+    int use_fcfs = argc > 2 ? strcmp(argv[2], "sem") != 0 : 1;
 
     /** Create a named semaphore to be shared with different processes.
      *
@@ -54,43 +96,81 @@ int main(int argc, char* argv[]) {
     // creation might fail if the named semaphore hasn't been deleted since its last creation
     // first we have to unlink it
 
+    // the same for the FCFS scheduler: the clients use it whenever it exists,
+    // so one left by a crashed FCFS server would take over a semaphore server
     sem_unlink(SEMAPHORE_NAME);
-    named_semaphore = sem_open(SEMAPHORE_NAME, O_CREAT | O_EXCL, 0600, NUM_RESOURCES);
-
-    if (named_semaphore == SEM_FAILED) {
-        handle_error("Could not open the named semaphore");
+    shm_unlink(FCFS_NAME);
+    if (use_fcfs) {
+        /** A named semaphore does not say which waiter gets the next free
+         * resource, so under load some clients starve. The FCFS scheduler
+         * serves them strictly in arrival order (see fcfs.h). **/
+        fcfs = fcfsCreate(NUM_RESOURCES);
+    } else {
+        named_semaphore = sem_open(SEMAPHORE_NAME, O_CREAT | O_EXCL, 0600, NUM_RESOURCES);
+
+        if (named_semaphore == SEM_FAILED) {
+            handle_error("Could not open the named semaphore");
+        }
     }
 
+    // shared block where the clients record their wait and hold times
+    stats = createStats();
+
     /* Since a CTRL+C would kill the program, we rely on an auxiliary
      * method to catch the interrupt and execute a cleanup code before
      * terminating the program. */
     setQuitHandler(&cleanup);
 
     printf("Welcome! This is the server module of our simple resource scheduler.\n\n");
-    printf("%d resources are initially available in the system. Use CTRL+C to exit!\n\n", NUM_RESOURCES);
+    printf("%d resources are initially available in the system (%s scheduler). Use CTRL+C to exit!\n\n",
+           NUM_RESOURCES, fcfs != NULL ? "FCFS" : "semaphore");
 
     /* Main loop */
+    unsigned long last_acquisitions = 0, last_report = now_ns();
     while(1) {
+        struct timespec pause = { log_interval / 1000, (log_interval % 1000) * 1000000L };
+        nanosleep(&pause, NULL);
+
         /** We want to periodically print statistics on our server's load to screen **/
         char timestamp[9];
-        time_t now = time(0);
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
 
         // get a timestamp of the form "HH:MM:SS" and store it into a buffer
-        strftime((char*)timestamp, 9, "%H:%M:%S", localtime(&now));
+        strftime((char*)timestamp, 9, "%H:%M:%S", localtime(&now.tv_sec));
 
         /** Get the current value for the semaphore and store it into a
          * custom local variable (we pass its address using &). The
          * value for the semaphore is the number of resources not in use. **/
-        int current_value;
-        ret = sem_getvalue(named_semaphore, &current_value);
-
-        if (ret) {
-            handle_error("Could not access the named semaphore");
+        int current_value, in_use, queued;
+        if (fcfs != NULL) {
+            fcfsUsage(fcfs, &in_use, &queued);
+            current_value = NUM_RESOURCES - in_use;
+        } else {
+            ret = sem_getvalue(named_semaphore, &current_value);
+
+            if (ret) {
+                handle_error("Could not access the named semaphore");
+            }
         }
 
-        printf("[%s] %d resources are available and %d are in use\n", timestamp, current_value, NUM_RESOURCES - current_value);
-
-        sleep(LOG_INTERVAL);
+        // what happened since the last report
+        unsigned long report = now_ns();
+        unsigned long acquisitions = atomic_load(&stats->acquisitions);
+        double rate = (acquisitions - last_acquisitions) * 1e9 / (report - last_report);
+        last_acquisitions = acquisitions;
+        last_report = report;
+
+        long waiting = atomic_load(&stats->waiting);
+        long peak = atomic_exchange(&stats->peak_waiting, waiting); // the next interval starts from here
+        statsSnapshot(stats->wait_hist, last_wait, &wait_interval, &wait_total);
+        statsSnapshot(stats->hold_hist, last_hold, &hold_interval, &hold_total);
+
+        printf("[%s.%03ld] %d in use, %d free, %ld waiting (peak %ld) | %.1f acq/s"
+               " | wait p50 %.1f p99 %.1f ms | hold p50 %.1f p99 %.1f ms\n",
+               timestamp, now.tv_nsec / 1000000, NUM_RESOURCES - current_value, current_value, waiting, peak, rate,
+               toMilliseconds(hist_percentile(&wait_interval, 50)), toMilliseconds(hist_percentile(&wait_interval, 99)),
+               toMilliseconds(hist_percentile(&hold_interval, 50)), toMilliseconds(hist_percentile(&hold_interval, 99)));
     }
 
     /*** We will never reach this point since we want to exit the program through CTRL+C only! ***/
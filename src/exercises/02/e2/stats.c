@@ -0,0 +1,100 @@
+#include "stats.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+sched_stats_t* createStats() {
+    int fd = shm_open(STATS_NAME, O_CREAT | O_RDWR, 0600);
+    if (fd == -1) handle_error("[server] shm_open error, stats");
+    if (ftruncate(fd, sizeof(sched_stats_t))) handle_error("[server] ftruncate error, stats");
+
+    sched_stats_t* stats = mmap(NULL, sizeof(sched_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (stats == MAP_FAILED) handle_error("[server] mmap error, stats");
+    close(fd);
+
+    // all counters start from zero, clients of a previous run included
+    memset(stats, 0, sizeof(sched_stats_t));
+    return stats;
+}
+
+void destroyStats(sched_stats_t* stats) {
+    if (munmap(stats, sizeof(sched_stats_t))) handle_error("[server] munmap error, stats");
+    if (shm_unlink(STATS_NAME)) handle_error("[server] shm_unlink error, stats");
+}
+
+sched_stats_t* openStats() {
+    int fd = shm_open(STATS_NAME, O_RDWR, 0);
+    if (fd == -1) handle_error("Could not open the statistics of the server");
+
+    sched_stats_t* stats = mmap(NULL, sizeof(sched_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (stats == MAP_FAILED) handle_error("Could not map the statistics of the server");
+    close(fd);
+    return stats;
+}
+
+void closeStats(sched_stats_t* stats) {
+    if (munmap(stats, sizeof(sched_stats_t))) handle_error("Could not unmap the statistics of the server");
+}
+
+unsigned long statsWaitBegin(sched_stats_t* stats) {
+    long waiting = atomic_fetch_add_explicit(&stats->waiting, 1, memory_order_relaxed) + 1;
+    long peak = atomic_load_explicit(&stats->peak_waiting, memory_order_relaxed);
+    while (waiting > peak &&
+           !atomic_compare_exchange_weak_explicit(&stats->peak_waiting, &peak, waiting,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+    return now_ns();
+}
+
+// returns the time the resource was acquired, to be passed to statsRelease()
+unsigned long statsWaitEnd(sched_stats_t* stats, unsigned long wait_start) {
+    unsigned long now = now_ns(), wait = now - wait_start;
+    atomic_fetch_sub_explicit(&stats->waiting, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->wait_hist[hist_bucket(wait)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->wait_sum, wait, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->acquisitions, 1, memory_order_relaxed);
+    return now;
+}
+
+void statsRelease(sched_stats_t* stats, unsigned long acquired_at) {
+    unsigned long hold = now_ns() - acquired_at;
+    atomic_fetch_add_explicit(&stats->hold_hist[hist_bucket(hold)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->hold_sum, hold, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->releases, 1, memory_order_relaxed);
+}
+
+// min and max are known up to the bucket resolution
+static void fixBounds(histogram* h) {
+    int i, lowest = -1, highest = -1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        if (h->buckets[i] == 0) continue;
+        if (lowest < 0) lowest = i;
+        highest = i;
+        h->count += h->buckets[i];
+    }
+    if (lowest >= 0) {
+        h->min = lowest > 0 ? hist_bucket_value(lowest - 1) + 1 : 0;
+        h->max = hist_bucket_value(highest);
+    }
+}
+
+void statsSnapshot(const atomic_ulong* src, unsigned long* last, histogram* interval, histogram* total) {
+    int i;
+    hist_init(interval);
+    hist_init(total);
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        // counters only grow, so the copy is consistent bucket by bucket
+        unsigned long cur = atomic_load_explicit((atomic_ulong*)&src[i], memory_order_relaxed);
+        interval->buckets[i] = cur - last[i];
+        total->buckets[i] = cur;
+        last[i] = cur;
+    }
+    fixBounds(interval);
+    fixBounds(total);
+}
@@ -0,0 +1,41 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+
+#include "../../01/performance.h"
+
+#define STATS_NAME          "/simple_scheduler_stats"
+
+/* Statistics kept in shared memory by the clients and read by the server.
+ * The server creates the block, clients map it and update it with atomic
+ * operations only, so recording costs no lock and no system call. The
+ * histograms use the bucket layout of ../../01/performance.h. */
+typedef struct sched_stats_s {
+    atomic_ulong    acquisitions;
+    atomic_ulong    releases;
+    atomic_long     waiting;        // clients blocked in sem_wait right now
+    atomic_long     peak_waiting;   // highest value of waiting since the server last looked
+    atomic_ulong    wait_sum, hold_sum;
+    atomic_ulong    wait_hist[HIST_BUCKETS];
+    atomic_ulong    hold_hist[HIST_BUCKETS];
+} sched_stats_t;
+
+// server side: create (or open) the block, and remove it at shutdown
+sched_stats_t* createStats();
+void destroyStats(sched_stats_t* stats);
+
+// client side
+sched_stats_t* openStats();
+void closeStats(sched_stats_t* stats);
+
+// to be called around sem_wait and after sem_post; times are from now_ns()
+unsigned long statsWaitBegin(sched_stats_t* stats);
+unsigned long statsWaitEnd(sched_stats_t* stats, unsigned long wait_start);
+void statsRelease(sched_stats_t* stats, unsigned long acquired_at);
+
+// copies a histogram out of the block: total gets all the samples, interval
+// those recorded since the previous call (last keeps the counters in between)
+void statsSnapshot(const atomic_ulong* src, unsigned long* last, histogram* interval, histogram* total);
+
+#endif
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Benchmarks of the 02/e3 buffer as producers and consumers grow:
+# - sync:   throughput and wakeups of the named semaphores and the robust mutex/condvar pair (SYNC_MODE)
+#           for each access mode of the buffer file
+# - shards: scaling of a buffer split into 1, 2, 4 or 8 shards (SHARDS) over NUM_PRODUCERS x NUM_CONSUMERS
+# Transactions are produced with no delay, so the synchronization and the file are the bottleneck;
+# nvcsw in the CSV counts the voluntary context switches (sleeps) of all the processes of a run.
+# usage: ./bench.sh [sync|shards|all]
+BENCH="../../bench/bench"
+OPERATIONS=${OPERATIONS:-9600}
+BUILD="make -s -B CFLAGS='-I. -O2 -Wall -DNUM_PRODUCERS={producers} -DNUM_CONSUMERS={consumers} -DNUM_OPERATIONS=$OPERATIONS'"
+# the consumer starts once the producer reports that the semaphores or the shared segment exist
+RUN="rm -f bufferfile.bin*; ./producer | { read -r _; ./consumer; cat; }"
+
+make -s -C ../../bench || exit 1
+
+if [ "${1:-all}" != shards ]; then
+    $BENCH -r ${REPEATS:-3} -f csv -o sync.csv \
+        -p sync=sem,mutex -p mode=stdio,mmap -p producers=1,2,4 -p consumers=1,2,4 -b "$BUILD" \
+        -- sh -c "export SYNC_MODE={sync} BUFFER_MODE={mode} WORKLOAD=zero; $RUN"
+    echo "Results written to sync.csv"
+fi
+if [ "${1:-all}" != sync ]; then
+    $BENCH -r ${REPEATS:-3} -f csv -o shards.csv \
+        -p shards=1,2,4,8 -p mode=stdio,mmap -p producers=1,2,4,8 -p consumers=1,2,4,8 -b "$BUILD" \
+        -- sh -c "export SHARDS={shards} BUFFER_MODE={mode} WORKLOAD=zero; $RUN"
+    echo "Results written to shards.csv"
+fi
+make -s -B
+echo "(items/s = $OPERATIONS / wall_ns * 10^9, wakeups per item = nvcsw / $OPERATIONS)"
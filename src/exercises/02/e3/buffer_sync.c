@@ -0,0 +1,188 @@
+#include "buffer_sync.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+int parseSyncMode(const char* spec) {
+    if (spec == NULL || *spec == '\0' || strcmp(spec, "sem") == 0) return SYNC_MODE_SEM;
+    if (strcmp(spec, "mutex") == 0) return SYNC_MODE_MUTEX;
+    return -1;
+}
+
+static buffer_sync_t* mapBufferSync(int flags) {
+    int fd = shm_open(SHMNAME_SYNC, flags, 0644);
+    if (fd == -1) return NULL;
+    if ((flags & O_CREAT) && ftruncate(fd, sizeof(buffer_sync_t))) handle_error("ftruncate sync");
+
+    buffer_sync_t* s = mmap(NULL, sizeof(buffer_sync_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (s == MAP_FAILED) handle_error("mmap sync");
+    if (close(fd)) handle_error("close sync");
+    return s;
+}
+
+buffer_sync_t* createBufferSync(int queued) {
+    // delete a stale segment from a previous crash (if any)
+    shm_unlink(SHMNAME_SYNC);
+    buffer_sync_t* s = mapBufferSync(O_CREAT | O_EXCL | O_RDWR);
+    if (s == NULL) handle_error("shm_open sync");
+    memset(s, 0, sizeof(buffer_sync_t));
+
+    pthread_mutexattr_t ma;
+    int ret = pthread_mutexattr_init(&ma);
+    if (!ret) ret = pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    if (!ret) ret = pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    if (!ret) ret = pthread_mutex_init(&s->lock, &ma);
+    if (ret) handle_error_en(ret, "pthread_mutex_init sync");
+    pthread_mutexattr_destroy(&ma);
+
+    pthread_condattr_t ca;
+    ret = pthread_condattr_init(&ca);
+    if (!ret) ret = pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    if (!ret) ret = pthread_cond_init(&s->notEmpty, &ca);
+    if (!ret) ret = pthread_cond_init(&s->notFull, &ca);
+    if (ret) handle_error_en(ret, "pthread_cond_init sync");
+    pthread_condattr_destroy(&ca);
+
+    // as the semaphores, the counters start from the queued elements
+    s->filled = queued;
+    s->free = BUFFER_SIZE - queued;
+    return s;
+}
+
+buffer_sync_t* openBufferSync() {
+    buffer_sync_t* s = mapBufferSync(O_RDWR);
+    if (s == NULL) handle_error("shm_open sync (start the producer(s) with SYNC_MODE=mutex first)");
+    return s;
+}
+
+void closeBufferSync(buffer_sync_t* s) {
+    if (munmap(s, sizeof(buffer_sync_t))) handle_error("munmap sync");
+}
+
+void destroyBufferSync(buffer_sync_t* s) {
+    closeBufferSync(s);
+    if (shm_unlink(SHMNAME_SYNC)) handle_error("shm_unlink sync");
+}
+
+/* The owner of the mutex died in its critical section, so the counters may
+ * not match the buffer any more. The indexes in the file are the truth for
+ * the committed elements; a record taken but not counted yet is lost. The
+ * waiters are woken so that they check their condition again. */
+static void recoverBufferSync(buffer_sync_t* s, buffer_file_t* b) {
+    int queued = queuedInBufferFile(b->numElems, b->fileName);
+    s->filled = queued;
+    s->free = b->numElems - queued - s->pending;
+    if (s->free < 0) s->free = 0;
+    s->recoveries++;
+    fprintf(stderr, "Process %d: the owner of the buffer lock died, %d elements queued\n", getpid(), queued);
+
+    pthread_cond_broadcast(&s->notEmpty);
+    pthread_cond_broadcast(&s->notFull);
+    s->waitingConsumers = s->waitingProducers = 0;
+    int ret = pthread_mutex_consistent(&s->lock);
+    if (ret) handle_error_en(ret, "pthread_mutex_consistent");
+}
+
+static void lockBufferSync(buffer_sync_t* s, buffer_file_t* b) {
+    int ret = pthread_mutex_lock(&s->lock);
+    if (ret == EOWNERDEAD) recoverBufferSync(s, b);
+    else if (ret) handle_error_en(ret, "pthread_mutex_lock");
+}
+
+static void unlockBufferSync(buffer_sync_t* s) {
+    int ret = pthread_mutex_unlock(&s->lock);
+    if (ret) handle_error_en(ret, "pthread_mutex_unlock");
+}
+
+// pthread_cond_wait locks the mutex again, so it can find its owner dead too
+static void waitBufferSync(buffer_sync_t* s, pthread_cond_t* cond, buffer_file_t* b) {
+    s->waits++;
+    int ret = pthread_cond_wait(cond, &s->lock);
+    if (ret == EOWNERDEAD) recoverBufferSync(s, b);
+    else if (ret) handle_error_en(ret, "pthread_cond_wait");
+}
+
+/* Wakes as many consumers as there are new elements, and only if they wait.
+ * The waiting counters are decremented by whoever wakes a waiter, so a
+ * waiter that was signalled but did not run yet is not signalled again. */
+static void wakeConsumers(buffer_sync_t* s, int added) {
+    if (added == 0 || s->waitingConsumers == 0) return;
+    if (added == 1) {
+        pthread_cond_signal(&s->notEmpty);
+        s->waitingConsumers--;
+    } else {
+        pthread_cond_broadcast(&s->notEmpty);
+        s->waitingConsumers = 0;
+    }
+    s->signals++;
+}
+
+static void commitLocked(buffer_sync_t* s, buffer_file_t* b) {
+    int committed = commitBuffer(b);
+    s->pending = 0;
+    s->filled += committed;
+    wakeConsumers(s, committed);
+}
+
+/* Takes the lock and a free slot. As with the semaphores, in durable mode
+ * a producer commits the pending records before sleeping on a full buffer,
+ * as their slots are taken but the consumers cannot see them yet. */
+void beginPut(buffer_sync_t* s, buffer_file_t* b) {
+    lockBufferSync(s, b);
+    while (s->free == 0) {
+        if (s->pending) {
+            commitLocked(s, b);
+            continue;
+        }
+        s->waitingProducers++;
+        waitBufferSync(s, &s->notFull, b);
+    }
+    s->free--;
+}
+
+// committed is what putBuffer returned: 1, or in durable mode the records of a commit
+void endPut(buffer_sync_t* s, int committed) {
+    s->pending += 1 - committed;
+    s->filled += committed;
+    wakeConsumers(s, committed);
+    unlockBufferSync(s);
+}
+
+void commitSync(buffer_sync_t* s, buffer_file_t* b) {
+    lockBufferSync(s, b);
+    commitLocked(s, b);
+    unlockBufferSync(s);
+}
+
+void beginGet(buffer_sync_t* s, buffer_file_t* b) {
+    lockBufferSync(s, b);
+    while (s->filled == 0) {
+        s->waitingConsumers++;
+        waitBufferSync(s, &s->notEmpty, b);
+    }
+    s->filled--;
+}
+
+void endGet(buffer_sync_t* s) {
+    s->free++;
+    if (s->waitingProducers) {
+        pthread_cond_signal(&s->notFull);
+        s->waitingProducers--;
+        s->signals++;
+    }
+    unlockBufferSync(s);
+}
+
+/* Every sleep on a semaphore or a condition variable is a voluntary context
+ * switch of the process, so their number per item compares the wakeups of
+ * the two modes. Called by the parent after waiting for its children. */
+void printSyncStats(buffer_sync_t* s, int items) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_CHILDREN, &ru)) handle_error("getrusage");
+    printf("%ld voluntary context switches (%.2f per item)\n", ru.ru_nvcsw, items ? (double)ru.ru_nvcsw/items : 0.0);
+    if (s != NULL)
+        printf("%lu cond waits, %lu signals, %lu lock recoveries\n", s->waits, s->signals, s->recoveries);
+}
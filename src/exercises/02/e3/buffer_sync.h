@@ -0,0 +1,46 @@
+#ifndef BUFFER_SYNC_H
+#define BUFFER_SYNC_H
+
+#include "common.h"
+
+#include <pthread.h>
+
+/* Synchronization of the producers and consumers with a process-shared
+ * mutex and two condition variables kept in a shared memory segment
+ * (SHMNAME_SYNC), selected with SYNC_MODE=mutex. It replaces the three
+ * named semaphores: a handoff is one lock/unlock pair instead of four
+ * semaphore operations, and a waiter is woken only if somebody waits.
+ *
+ * The mutex is robust: if a process dies while holding it, the next one
+ * to lock it gets EOWNERDEAD, recomputes the counters from the indexes in
+ * the buffer file and marks the mutex consistent, instead of deadlocking
+ * every other process. */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;    // filled > 0
+    pthread_cond_t notFull;     // free > 0
+    int filled;                 // committed elements the consumers can take
+    int free;                   // slots not taken by an element
+    int pending;                // durable mode: written but not committed yet
+    int waitingProducers;       // asleep and not signalled yet
+    int waitingConsumers;       // asleep and not signalled yet
+    unsigned long waits;        // cond waits, i.e. sleeps and wakeups
+    unsigned long signals;      // cond signals and broadcasts
+    unsigned long recoveries;   // EOWNERDEAD handled
+} buffer_sync_t;
+
+// methods defined in buffer_sync.c
+int parseSyncMode(const char* spec);
+buffer_sync_t* createBufferSync(int queued);
+buffer_sync_t* openBufferSync();
+void closeBufferSync(buffer_sync_t* s);
+void destroyBufferSync(buffer_sync_t* s);
+
+void beginPut(buffer_sync_t* s, buffer_file_t* b);
+void endPut(buffer_sync_t* s, int committed);
+void commitSync(buffer_sync_t* s, buffer_file_t* b);
+void beginGet(buffer_sync_t* s, buffer_file_t* b);
+void endGet(buffer_sync_t* s);
+void printSyncStats(buffer_sync_t* s, int items);
+
+#endif
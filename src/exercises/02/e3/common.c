@@ -1,19 +1,99 @@
 #include "common.h"
+#include "seglog.h"
 
-void initFile(int numElems, char* fileName) {
-    // I will create a zero-filled file of (2+numElems)*sizeof(int) bytes
-    // where the last 8 bytes are used for storing read & write indexes
-    FILE* fp = fopen(fileName, "wb");
-    if (fp == NULL) handle_error("initFile fopen");
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-    int i, ret, value=0;
-    for (i=0; i<numElems+2; ++i) {
-        ret = fwrite(&value, sizeof(int), 1, fp);
-        if (ret != 1) handle_error("initFile fwrite");
-    }    
+// FNV-1a over the fields that never change after the file is created
+static uint32_t headerChecksum(const buffer_header_t* h) {
+    const unsigned char* p = (const unsigned char*) h;
+    size_t i, n = offsetof(buffer_header_t, checksum);
+    uint32_t hash = 2166136261u;
+    for (i=0; i<n; ++i) hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
 
-    ret = fclose(fp);
-    if (ret == EOF) handle_error("initFile fclose");
+static inline off_t headerOffset(int numElems) {
+    return (numElems+2)*sizeof(int);
+}
+
+static inline size_t bufferFileSize(int numElems) {
+    return headerOffset(numElems) + sizeof(buffer_header_t);
+}
+
+// returns 0 if fd holds a valid buffer of numElems elements, ENOENT if the
+// file is not a buffer file at all, EINVAL if it is a damaged or different one
+static int checkBufferFile(int fd, int numElems, buffer_header_t* h) {
+    struct stat st;
+    if (fstat(fd, &st)) handle_error("fstat buffer file");
+    if (st.st_size < (off_t) bufferFileSize(numElems)) return ENOENT;
+    if (pread(fd, h, sizeof(*h), headerOffset(numElems)) != sizeof(*h)) return ENOENT;
+    if (h->magic != BUFFER_MAGIC) return ENOENT;
+
+    if (h->version != BUFFER_VERSION || h->checksum != headerChecksum(h)) return EINVAL;
+    if (h->capacity != (uint32_t) numElems || st.st_size != (off_t) bufferFileSize(numElems)) {
+        fprintf(stderr, "The buffer file holds %u elements, not %d: rebuild with -DBUFFER_SIZE=%u or delete it\n",
+                h->capacity, numElems, h->capacity);
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+// number of elements between the read and the write index stored in the file
+static int queuedElements(int fd, int numElems, const buffer_header_t* h) {
+    int indexes[2];
+    if (pread(fd, indexes, sizeof(indexes), numElems*sizeof(int)) != sizeof(indexes))
+        handle_error("pread indexes");
+    if (indexes[0] < 0 || indexes[0] >= numElems || indexes[1] < 0 || indexes[1] >= numElems)
+        handle_error_en(EINVAL, "damaged buffer file");
+    return h->full ? numElems : (indexes[1] - indexes[0] + numElems) % numElems;
+}
+
+int queuedInBufferFile(int numElems, char* fileName) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd == -1) handle_error("queuedInBufferFile open");
+    buffer_header_t h;
+    if (checkBufferFile(fd, numElems, &h)) handle_error_en(EINVAL, "queuedInBufferFile: not a valid buffer file");
+    int queued = queuedElements(fd, numElems, &h);
+    if (close(fd)) handle_error("queuedInBufferFile close");
+    return queued;
+}
+
+int initFile(int numElems, char* fileName) {
+    /* The file holds numElems elements, the read & write indexes and a
+     * header, placed last so that the elements start at offset 0. If a
+     * valid buffer file of the same capacity exists we resume from its
+     * indexes, so that a restart does not lose the queued elements. */
+    int fd = open(fileName, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) handle_error("initFile open");
+
+    buffer_header_t h;
+    int ret = checkBufferFile(fd, numElems, &h);
+    if (ret == EINVAL) handle_error_en(EINVAL, "initFile: damaged buffer file");
+
+    int queued = 0;
+    if (ret == 0) {
+        queued = queuedElements(fd, numElems, &h);
+    } else {
+        // a single ftruncate gives a zero-filled (sparse) file of any size
+        if (ftruncate(fd, 0) || ftruncate(fd, bufferFileSize(numElems))) handle_error("initFile ftruncate");
+
+        memset(&h, 0, sizeof(h));
+        h.magic = BUFFER_MAGIC;
+        h.version = BUFFER_VERSION;
+        h.capacity = numElems;
+        h.checksum = headerChecksum(&h);
+        if (pwrite(fd, &h, sizeof(h), headerOffset(numElems)) != sizeof(h)) handle_error("initFile pwrite header");
+        if (fdatasync(fd)) handle_error("initFile fdatasync");
+    }
+
+    if (close(fd)) handle_error("initFile close");
+    return queued;
 }
 
 void writeToBufferFile(int value, int numElems, char* fileName) {
@@ -42,6 +122,20 @@ void writeToBufferFile(int value, int numElems, char* fileName) {
     ret = fwrite(&write_index, sizeof(int), 1, fp);
     if (ret != 1) handle_error("writeToBufferFile fwrite index"); 
 
+    // catching up with read_index means full, not empty
+    int read_index;
+    ret = fseek(fp, numElems*sizeof(int), SEEK_SET);
+    if (ret) handle_error("writeToBufferFile fseek read index");
+    ret = fread(&read_index, sizeof(int), 1, fp);
+    if (ret != 1) handle_error("writeToBufferFile fread read index");
+    if (read_index == write_index) {
+        int full = 1;
+        ret = fseek(fp, headerOffset(numElems) + offsetof(buffer_header_t, full), SEEK_SET);
+        if (ret) handle_error("writeToBufferFile fseek full");
+        ret = fwrite(&full, sizeof(int), 1, fp);
+        if (ret != 1) handle_error("writeToBufferFile fwrite full");
+    }
+
     ret = fclose(fp);
     if (ret == EOF) handle_error("writeToBufferFile fclose");
 }
@@ -72,8 +166,260 @@ int readFromBufferFile(int numElems, char* fileName) {
     ret = fwrite(&read_index, sizeof(int), 1, fp);
     if (ret != 1) handle_error("readFromBufferFile fwrite index");
 
+    int full = 0;
+    ret = fseek(fp, headerOffset(numElems) + offsetof(buffer_header_t, full), SEEK_SET);
+    if (ret) handle_error("readFromBufferFile fseek full");
+    ret = fwrite(&full, sizeof(int), 1, fp);
+    if (ret != 1) handle_error("readFromBufferFile fwrite full");
+
     ret = fclose(fp);
     if (ret == EOF) handle_error("readFromBufferFile fclose");
 
     return value;
-}
\ No newline at end of file
+}
+
+static int parseCount(const char* str, const char* prefix, long* out) {
+    size_t len = strlen(prefix);
+    if (strncmp(str, prefix, len)) return 0;
+    if (str[len] == '\0' || str[len] == ',') {
+        *out = 1;
+        return len;
+    }
+    if (str[len] != '=') return -1;
+
+    char* end;
+    long n = strtol(str+len+1, &end, 10);
+    if (end == str+len+1 || (*end != '\0' && *end != ',') || n <= 0) return -1;
+    *out = n;
+    return end - str;
+}
+
+int parseBufferMode(buffer_file_t* b, const char* spec) {
+    b->mode = BUFFER_MODE_STDIO;
+    b->syncEvery = 0;
+    b->commitEvery = 0;
+    b->commitNs = 0;
+    b->segmentRecords = LOG_SEGMENT_RECORDS;
+    if (spec == NULL || *spec == '\0' || strcmp(spec, "stdio") == 0) return 0;
+
+    const char* options;
+    if (strncmp(spec, "mmap", 4) == 0) {
+        b->mode = BUFFER_MODE_MMAP;
+        options = spec + 4;
+    } else if (strncmp(spec, "durable", 7) == 0) {
+        b->mode = BUFFER_MODE_DURABLE;
+        options = spec + 7;
+    } else if (strncmp(spec, "log", 3) == 0) {
+        b->mode = BUFFER_MODE_LOG;
+        options = spec + 3;
+    } else {
+        return EINVAL;
+    }
+
+    while (*options == ',') {
+        long n;
+        int len;
+        options++;
+        if (b->mode == BUFFER_MODE_MMAP && (len = parseCount(options, "sync", &n)) != 0) {
+            b->syncEvery = n;
+        } else if (b->mode == BUFFER_MODE_DURABLE && (len = parseCount(options, "every", &n)) != 0) {
+            b->commitEvery = n;
+        } else if (b->mode == BUFFER_MODE_DURABLE && (len = parseCount(options, "us", &n)) != 0) {
+            b->commitNs = n*1000;
+        } else if (b->mode == BUFFER_MODE_LOG && (len = parseCount(options, "segment", &n)) != 0) {
+            b->segmentRecords = n;
+        } else {
+            return EINVAL;
+        }
+        if (len < 0) return EINVAL;
+        options += len;
+    }
+    return *options == '\0' ? 0 : EINVAL;
+}
+
+void openBufferFile(buffer_file_t* b, int numElems, char* fileName) {
+    if (parseBufferMode(b, getenv("BUFFER_MODE"))) handle_error_en(EINVAL, "invalid BUFFER_MODE");
+    if (b->mode == BUFFER_MODE_LOG) handle_error_en(EINVAL, "openBufferFile: BUFFER_MODE=log has no buffer file");
+
+    b->numElems = numElems;
+    b->fileName = fileName;
+    b->fd = -1;
+    b->map = NULL;
+    b->commit = NULL;
+    b->header = NULL;
+    b->length = bufferFileSize(numElems);
+    b->unsynced = 0;
+    b->ops = b->ns = 0;
+
+    int fd = open(fileName, O_RDWR);
+    if (fd == -1) handle_error("openBufferFile open");
+    buffer_header_t h;
+    if (checkBufferFile(fd, numElems, &h)) handle_error_en(EINVAL, "openBufferFile: not a valid buffer file");
+    if (b->mode == BUFFER_MODE_STDIO) {
+        if (close(fd)) handle_error("openBufferFile close");
+        return;
+    }
+
+    if (b->mode == BUFFER_MODE_DURABLE) {
+        /* The commit state is shared by the processes forked after this
+         * call; it starts from the committed write index in the file. */
+        b->fd = fd;
+        b->commit = mmap(NULL, sizeof(buffer_commit_t), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (b->commit == MAP_FAILED) handle_error("openBufferFile mmap commit");
+        memset(b->commit, 0, sizeof(buffer_commit_t));
+
+        int write_index;
+        if (pread(fd, &write_index, sizeof(int), (numElems+1)*sizeof(int)) != sizeof(int))
+            handle_error("openBufferFile pread index");
+        b->commit->writeIndex = write_index;
+        return;
+    }
+
+    // the mapping outlives the descriptor, and is inherited by forked children
+    void* map = mmap(NULL, b->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) handle_error("openBufferFile mmap");
+    if (close(fd)) handle_error("openBufferFile close");
+    b->map = map;
+    b->header = (buffer_header_t*) &b->map[numElems+2];
+}
+
+static void syncBufferFile(buffer_file_t* b) {
+    if (msync(b->map, b->length, MS_SYNC)) handle_error("msync");
+    b->unsynced = 0;
+}
+
+void closeBufferFile(buffer_file_t* b) {
+    if (b->fd != -1) {
+        if (close(b->fd)) handle_error("closeBufferFile close");
+        b->fd = -1;
+    }
+    if (b->commit != NULL) {
+        if (munmap(b->commit, sizeof(buffer_commit_t))) handle_error("closeBufferFile munmap commit");
+        b->commit = NULL;
+    }
+    if (b->map == NULL) return;
+    if (b->syncEvery && b->unsynced) syncBufferFile(b);
+    if (munmap(b->map, b->length)) handle_error("closeBufferFile munmap");
+    b->map = NULL;
+}
+
+static inline unsigned long bufferClock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000UL + ts.tv_nsec;
+}
+
+static void writeIndex(buffer_file_t* b, int index, off_t offset) {
+    if (pwrite(b->fd, &index, sizeof(int), offset) != sizeof(int)) handle_error("pwrite index");
+}
+
+static int readIndex(buffer_file_t* b, off_t offset) {
+    int index;
+    if (pread(b->fd, &index, sizeof(int), offset) != sizeof(int)) handle_error("pread index");
+    return index;
+}
+
+/* One commit covers the records of every producer written since the last
+ * one: a first fdatasync makes the elements durable, and only then the write
+ * index is advanced past them and synced in turn. A crash can thus lose
+ * uncommitted records, but never expose an element that is not on disk.
+ * The caller holds sem_cs (or the mutex), like the producers that write the
+ * records: the full flag set here is cleared by the consumers, and must not
+ * be set after they have moved the read index. */
+int commitBuffer(buffer_file_t* b) {
+    buffer_commit_t* c = b->commit;
+    if (c == NULL || c->pending == 0) return 0;
+
+    if (fdatasync(b->fd)) handle_error("fdatasync elements");
+    writeIndex(b, c->writeIndex, (b->numElems+1)*sizeof(int));
+    if (c->writeIndex == readIndex(b, b->numElems*sizeof(int)))
+        writeIndex(b, 1, headerOffset(b->numElems) + offsetof(buffer_header_t, full));
+    if (fdatasync(b->fd)) handle_error("fdatasync index");
+
+    int committed = c->pending;
+    c->records += committed;
+    c->commits++;
+    c->syncs += 2;
+    c->pending = 0;
+    return committed;
+}
+
+/* Nanoseconds until the oldest pending record is due to be committed (us=T),
+ * 0 if it is overdue, -1 if there is no deadline or nothing is pending. It
+ * is read without sem_cs, as a hint for a committer that then takes it. */
+long commitDueIn(buffer_file_t* b) {
+    buffer_commit_t* c = b->commit;
+    if (c == NULL || b->commitNs == 0 || c->pending == 0) return -1;
+    unsigned long elapsed = bufferClock() - c->firstPending;
+    return elapsed >= b->commitNs ? 0 : (long)(b->commitNs - elapsed);
+}
+
+// the caller holds sem_cs, whose wait/post order the accesses to the mapping
+int putBuffer(buffer_file_t* b, int value) {
+    int committed = 1;
+    unsigned long start = bufferClock();
+    if (b->commit != NULL) {
+        buffer_commit_t* c = b->commit;
+        if (pwrite(b->fd, &value, sizeof(int), c->writeIndex*sizeof(int)) != sizeof(int))
+            handle_error("putBuffer pwrite element");
+        c->writeIndex = (c->writeIndex + 1) % b->numElems;
+        if (c->pending++ == 0) c->firstPending = start;
+
+        committed = 0;
+        if ((b->commitEvery && c->pending >= b->commitEvery) ||
+            (b->commitNs && start - c->firstPending >= b->commitNs))
+            committed = commitBuffer(b);
+    } else if (b->map == NULL) {
+        writeToBufferFile(value, b->numElems, b->fileName);
+    } else {
+        int* write_index = &b->map[b->numElems+1];
+        b->map[*write_index] = value;
+        *write_index = (*write_index + 1) % b->numElems;
+        if (*write_index == b->map[b->numElems]) b->header->full = 1;
+        if (b->syncEvery && ++b->unsynced >= b->syncEvery) syncBufferFile(b);
+    }
+    b->ns += bufferClock() - start;
+    b->ops++;
+    return committed;
+}
+
+int getBuffer(buffer_file_t* b) {
+    int value;
+    unsigned long start = bufferClock();
+    if (b->fd != -1) {
+        // consumption is not synced: after a crash, records may be read again
+        off_t rindex_offset = b->numElems*sizeof(int);
+        int read_index = readIndex(b, rindex_offset);
+        if (pread(b->fd, &value, sizeof(int), read_index*sizeof(int)) != sizeof(int))
+            handle_error("getBuffer pread element");
+        writeIndex(b, (read_index + 1) % b->numElems, rindex_offset);
+        writeIndex(b, 0, headerOffset(b->numElems) + offsetof(buffer_header_t, full));
+    } else if (b->map == NULL) {
+        value = readFromBufferFile(b->numElems, b->fileName);
+    } else {
+        int* read_index = &b->map[b->numElems];
+        value = b->map[*read_index];
+        *read_index = (*read_index + 1) % b->numElems;
+        b->header->full = 0;
+        if (b->syncEvery && ++b->unsynced >= b->syncEvery) syncBufferFile(b);
+    }
+    b->ns += bufferClock() - start;
+    b->ops++;
+    return value;
+}
+
+// number of shards from $SHARDS, -1 if invalid or not a divisor of BUFFER_SIZE
+int parseShards(const char* spec) {
+    if (spec == NULL || *spec == '\0') return 1;
+    char* end;
+    long n = strtol(spec, &end, 10);
+    if (*end != '\0' || n < 1 || n > MAX_SHARDS || BUFFER_SIZE % n) return -1;
+    return n;
+}
+
+// an unsharded buffer (or shard -1) keeps the plain names, shard i of a sharded one appends .i
+void shardName(char* dst, const char* base, int shard, int numShards) {
+    if (numShards == 1 || shard < 0) snprintf(dst, MAX_NAME_LEN, "%s", base);
+    else snprintf(dst, MAX_NAME_LEN, "%s.%d", base, shard);
+}
@@ -1,5 +1,10 @@
+#ifndef COMMON_H
+#define COMMON_H
+
 #include <errno.h>
+#include <semaphore.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 // macros for handling errors
@@ -9,15 +14,23 @@
     do { perror(msg); exit(EXIT_FAILURE); } while (0)
 
 // macros for producer.c and consumer.c
+#ifndef BUFFER_SIZE
 #define BUFFER_SIZE         128
+#endif
 #define BUFFER_FILENAME     "bufferfile.bin"
 #define INITIAL_DEPOSIT     0
 #define MAX_TRANSACTION     1000
+#ifndef NUM_CONSUMERS
 #define NUM_CONSUMERS       2
+#endif
+#ifndef NUM_PRODUCERS
 #define NUM_PRODUCERS       1
+#endif
 #define PRNG_SEED           0
 
+#ifndef NUM_OPERATIONS
 #define NUM_OPERATIONS      400
+#endif
 #define OPS_PER_CONSUMER    (NUM_OPERATIONS/NUM_CONSUMERS)
 #define OPS_PER_PRODUCER    (NUM_OPERATIONS/NUM_PRODUCERS)
 
@@ -28,9 +41,117 @@
 #define SEMNAME_FILLED      "/mysemfilled"
 #define SEMNAME_EMPTY       "/mysemempty"
 #define SEMNAME_CS          "/mysemcs"
+#define SHMNAME_SYNC        "/mybuffersync"
+
+/* The buffer can be split into SHARDS (environment variable, default 1)
+ * independent shards of BUFFER_SIZE/SHARDS elements, each with its own
+ * file, indexes and semaphores, so that processes working on different
+ * shards do not serialize on a single sem_cs. Shard i uses the file and
+ * semaphore names above followed by ".i". Producers go round-robin over
+ * the shards; a consumer starts from its home shard and steals from the
+ * others when it is empty, after waiting on SEMNAME_ITEMS, which counts
+ * the elements of every shard. */
+#define MAX_SHARDS          16
+#define MAX_NAME_LEN        64
+#define SEMNAME_ITEMS       "/mysemitems"
+
+/* How the processes synchronize, from the SYNC_MODE environment variable:
+ * - sem      the three named semaphores above (default)
+ * - mutex    a robust process-shared mutex and two condition variables in
+ *            the SHMNAME_SYNC segment (see buffer_sync.h)
+ * Producers and consumers must use the same mode. */
+#define SYNC_MODE_SEM       0
+#define SYNC_MODE_MUTEX     1
+
+
+/* Header of the buffer file, stored after the elements and the indexes.
+ * It lets a producer validate an existing file and resume from it. */
+#define BUFFER_MAGIC        0x46554252  // "RBUF"
+#define BUFFER_VERSION      1
 
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;      // number of elements
+    uint32_t checksum;      // of the fields above
+    int32_t full;           // read index == write index means full, not empty
+} buffer_header_t;
+
+/* How the buffer file is accessed, from the BUFFER_MODE environment variable:
+ * - stdio          fopen/fseek/fread/fwrite/fclose on every operation (default)
+ * - mmap           the file is mapped once with MAP_SHARED and the elements
+ *                  and indexes are accessed in place
+ * - mmap,sync[=N]  as mmap, with an msync(MS_SYNC) every N operations
+ *                  (every operation if N is omitted) and one on close
+ * - durable[,every=N][,us=T]
+ *                  producers pwrite their records and group-commit them:
+ *                  one fdatasync covers the records of all the producers,
+ *                  and only then the write index advances and the consumers
+ *                  are notified. A commit happens every N records, when the
+ *                  oldest pending record is T microseconds old (on the next
+ *                  write, or by the producers' main process if nobody
+ *                  writes in time), and always before a producer blocks on
+ *                  a full buffer or exits
+ * - log[,segment=N]
+ *                  the circular file is replaced by an append-only log of
+ *                  segment files of N records each (see seglog.h), read by
+ *                  consumer groups named by LOG_GROUP
+ * The on-disk layout is the same in every mode but log, so processes using
+ * different modes can share the file. */
+#define BUFFER_MODE_STDIO   0
+#define BUFFER_MODE_MMAP    1
+#define BUFFER_MODE_DURABLE 2
+#define BUFFER_MODE_LOG     3
+
+// group commit state, shared by the producers through an anonymous mapping
+typedef struct {
+    int writeIndex;             // next slot, ahead of the index in the file
+    int pending;                // records written since the last commit
+    unsigned long firstPending; // when the oldest pending record was written
+    unsigned long records;      // committed records, commits and fdatasyncs
+    unsigned long commits;
+    unsigned long syncs;
+} buffer_commit_t;
+
+typedef struct {
+    int mode;
+    int numElems;
+    char* fileName;
+    int fd;                 // durable mode
+    int* map;               // numElems elements, read and write index, header
+    buffer_header_t* header;
+    size_t length;
+    int syncEvery;          // 0 = never msync
+    int unsynced;
+    long commitEvery;       // durable mode policy, 0 = off
+    unsigned long commitNs;
+    buffer_commit_t* commit;
+    long segmentRecords;    // log mode
+    unsigned long ops;      // operations and time spent in them
+    unsigned long ns;
+} buffer_file_t;
+
+typedef struct {
+    char fileName[MAX_NAME_LEN];
+    buffer_file_t buffer;   // opened before forking, the mapping is shared
+    sem_t *filled, *empty, *cs;
+} shard_t;
 
 // methods defined in common.c
-void initFile(int numElems, char* fileName);
+int initFile(int numElems, char* fileName);
+int queuedInBufferFile(int numElems, char* fileName);
 void writeToBufferFile(int value, int numElems, char* fileName);
-int readFromBufferFile(int numElems, char* fileName);
\ No newline at end of file
+int readFromBufferFile(int numElems, char* fileName);
+
+int parseBufferMode(buffer_file_t* b, const char* spec);
+void openBufferFile(buffer_file_t* b, int numElems, char* fileName);
+void closeBufferFile(buffer_file_t* b);
+int putBuffer(buffer_file_t* b, int value);
+int commitBuffer(buffer_file_t* b);
+long commitDueIn(buffer_file_t* b);
+int getBuffer(buffer_file_t* b);
+
+int parseShards(const char* spec);
+void shardName(char* dst, const char* base, int shard, int numShards);
+
+#endif
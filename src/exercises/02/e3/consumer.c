@@ -1,4 +1,6 @@
 #include "common.h"
+#include "buffer_sync.h"
+#include "seglog.h"
 
 #include <semaphore.h>
 #include <stdio.h>
@@ -6,9 +8,26 @@
 #include <unistd.h>
 #include <sys/wait.h>
 
-sem_t *sem_filled, *sem_empty, *sem_cs;
+shard_t shards[MAX_SHARDS];
+int numShards;
+sem_t* sem_items = NULL;            // sharded buffer only
+buffer_sync_t* buffer_sync = NULL;  // SYNC_MODE=mutex, replaces the semaphores
+buffer_file_t mode;                 // BUFFER_MODE, parsed once
+seglog_t seglog;                    // BUFFER_MODE=log, replaces the buffer file
+
+sem_t* openSemaphore(const char* base, int shard) {
+    char name[MAX_NAME_LEN];
+    shardName(name, base, shard, numShards);
+    return sem_open(name, 0);
+}
+
+void unlinkSemaphore(const char* base, int shard) {
+    char name[MAX_NAME_LEN];
+    shardName(name, base, shard, numShards);
+    if (sem_unlink(name)) handle_error("sem_unlink");
+}
 
-void openSemaphores() {
+void openSemaphores(shard_t* sh, int shard) {
 
     /* We have to open three named semaphores created in producer.c:
     * - sem_filled, used to check that our buffer is not empty
@@ -16,93 +35,182 @@ void openSemaphores() {
     * - sem_cs, to avoid race conditions when accessing the file
     */
 
-    sem_filled = sem_open(SEMNAME_FILLED, 0);
-    if (sem_filled == SEM_FAILED) handle_error("sem_open filled");
+    sh->filled = openSemaphore(SEMNAME_FILLED, shard);
+    if (sh->filled == SEM_FAILED) handle_error("sem_open filled");
 
-    sem_empty = sem_open(SEMNAME_EMPTY, 0);
-    if (sem_empty == SEM_FAILED) handle_error("sem_open empty");
+    sh->empty = openSemaphore(SEMNAME_EMPTY, shard);
+    if (sh->empty == SEM_FAILED) handle_error("sem_open empty");
 
-    sem_cs = sem_open(SEMNAME_CS, 0);
-    if (sem_cs == SEM_FAILED) handle_error("sem_open cs");
+    sh->cs = openSemaphore(SEMNAME_CS, shard);
+    if (sh->cs == SEM_FAILED) handle_error("sem_open cs");
 }
 
 void closeAndDestroySemaphores() {
-    int ret;
+    int i, ret;
 
     /* When the program that controls the consumer(s) terminates, we need
-     * to close the three semaphores and also delete (unlink) them. */
+     * to close the three semaphores of each shard and also delete
+     * (unlink) them. */
 
-    ret = sem_close(sem_filled);
-    if (ret) handle_error("sem_close filled");
+    for (i=0; i<numShards; ++i) {
+        ret = sem_close(shards[i].filled);
+        if (ret) handle_error("sem_close filled");
 
-    ret = sem_close(sem_empty);
-    if (ret) handle_error("sem_close empty");
+        ret = sem_close(shards[i].empty);
+        if (ret) handle_error("sem_close empty");
 
-    ret = sem_close(sem_cs);
-    if (ret) handle_error("sem_close cs");
+        ret = sem_close(shards[i].cs);
+        if (ret) handle_error("sem_close cs");
 
-    ret = sem_unlink(SEMNAME_FILLED);
-    if (ret) handle_error("sem_unlink filled");
+        unlinkSemaphore(SEMNAME_FILLED, i);
+        unlinkSemaphore(SEMNAME_EMPTY, i);
+        unlinkSemaphore(SEMNAME_CS, i);
+    }
 
-    ret = sem_unlink(SEMNAME_EMPTY);
-    if (ret) handle_error("sem_unlink empty");
+    if (sem_items != NULL) {
+        ret = sem_close(sem_items);
+        if (ret) handle_error("sem_close items");
+        unlinkSemaphore(SEMNAME_ITEMS, -1);
+    }
+}
 
-    ret = sem_unlink(SEMNAME_CS);
-    if (ret) handle_error("sem_unlink cs");
+/* Takes an element of a shard, preferring the home one. With a sharded
+ * buffer the consumer first waits on sem_items, whose count is the number
+ * of elements in all the shards: once it gets past it, some shard holds an
+ * element that no other consumer can claim, so the scan always ends. */
+shard_t* takeShard(int home, int* stolen) {
+    if (numShards == 1) {
+        int ret = sem_wait(shards[0].filled);
+        if (ret) handle_error("sem_wait filled");
+        return &shards[0];
+    }
 
+    int ret = sem_wait(sem_items);
+    if (ret) handle_error("sem_wait items");
+    int i;
+    for (i=0; ; i=(i+1)%numShards) {
+        shard_t* sh = &shards[(home + i) % numShards];
+        if (sem_trywait(sh->filled) == 0) {
+            if (i) (*stolen)++;
+            return sh;
+        }
+        if (errno != EAGAIN) handle_error("sem_trywait filled");
+    }
 }
 
 void consume(int id, int numOps) {
-    int localSum = 0;
+    int localSum = 0, stolen = 0;
     while (numOps > 0) {
 
+        if (buffer_sync != NULL) {
+            // beginGet waits for an element under the lock, endGet frees its slot
+            beginGet(buffer_sync, &shards[0].buffer);
+            localSum += getBuffer(&shards[0].buffer);
+            endGet(buffer_sync);
+
+            numOps--;
+            continue;
+        }
+
         /* Before accessing the critical section and reading from the
          * buffer, we require that two conditions be verified:
         * - there is at least one value to read in the buffer
         * - access to the buffer is regulated via mutual exclusion
         * We can enforce the first condition by waiting on the sem_filled
-        * semaphore, and the second by waiting on the sem_cs semaphore. */
+        * semaphore of a shard, and the second by waiting on its sem_cs. */
 
-        int ret = sem_wait(sem_filled);
-        if (ret) handle_error("sem_wait filled");
+        shard_t* sh = takeShard(id % numShards, &stolen);
 
-        ret = sem_wait(sem_cs);
+        int ret = sem_wait(sh->cs);
         if (ret) handle_error("sem_wait cs");
 
         // CRITICAL SECTION
-        int value = readFromBufferFile(BUFFER_SIZE, BUFFER_FILENAME);
+        int value = getBuffer(&sh->buffer);
         localSum += value;
 
         /* On leaving the critical section we have to "release" the
          * shared resource via sem_cs, and notify the producer(s) that a
          * cell in the buffer is now free using the semaphore sem_empty. */
 
-        ret = sem_post(sem_cs);
+        ret = sem_post(sh->cs);
         if (ret) handle_error("sem_post cs");
 
-        ret = sem_post(sem_empty);
+        ret = sem_post(sh->empty);
         if (ret) handle_error("sem_post empty");
 
         numOps--;
     }
-    printf("Consumer %d ended. Local sum is %d\n", id, localSum);
+
+    int i;
+    unsigned long ops = 0, ns = 0;
+    for (i=0; i<numShards; ++i) {
+        ops += shards[i].buffer.ops;
+        ns += shards[i].buffer.ns;
+        closeBufferFile(&shards[i].buffer);
+    }
+    printf("Consumer %d ended. Local sum is %d (%lu ns per buffer operation, %d stolen)\n",
+           id, localSum, ops ? ns/ops : 0, stolen);
+    fflush(stdout);    // the child leaves with _exit, which does not flush
 }
 
-int main(int argc, char** argv) {
-    if (access(BUFFER_FILENAME, F_OK) == -1) {
-        printf("ERROR: no buffer file. Start the producer(s) first!\n");
-        exit(EXIT_FAILURE);
+// the consumers of a program form one group, joined before forking
+void consumeLog(int id, int numOps) {
+    int localSum = 0;
+    while (numOps > 0) {
+        localSum += readLog(&seglog);
+        numOps--;
     }
+    printf("Consumer %d ended. Local sum is %d (%lu ns per log operation)\n",
+           id, localSum, seglog.ops ? seglog.ns/seglog.ops : 0);
+    fflush(stdout);    // the child leaves with _exit, which does not flush
+    closeLog(&seglog);
+}
 
-    openSemaphores();
+int main(int argc, char** argv) {
+    int syncMode = parseSyncMode(getenv("SYNC_MODE"));
+    if (syncMode < 0) handle_error_en(EINVAL, "invalid SYNC_MODE");
+    numShards = parseShards(getenv("SHARDS"));
+    if (numShards < 0) handle_error_en(EINVAL, "invalid SHARDS (must divide BUFFER_SIZE)");
+    if (numShards > 1 && syncMode != SYNC_MODE_SEM) handle_error_en(EINVAL, "SHARDS needs SYNC_MODE=sem");
+    if (parseBufferMode(&mode, getenv("BUFFER_MODE"))) handle_error_en(EINVAL, "invalid BUFFER_MODE");
+    int logMode = mode.mode == BUFFER_MODE_LOG;
+    if (logMode && (numShards > 1 || syncMode != SYNC_MODE_SEM))
+        handle_error_en(EINVAL, "BUFFER_MODE=log has its own synchronization, unset SHARDS and SYNC_MODE");
 
     int i;
+    const char* group = getenv("LOG_GROUP");
+    if (logMode) {
+        if (access(LOG_FILENAME ".index", F_OK) == -1) {
+            printf("ERROR: no log. Start the producer(s) first!\n");
+            exit(EXIT_FAILURE);
+        }
+        openLog(&seglog, 0, mode.segmentRecords);
+        joinLog(&seglog, group != NULL && *group != '\0' ? group : "default");
+        numShards = 0;
+    }
+    for (i=0; i<numShards; ++i) {
+        shard_t* sh = &shards[i];
+        shardName(sh->fileName, BUFFER_FILENAME, i, numShards);
+        if (access(sh->fileName, F_OK) == -1) {
+            printf("ERROR: no buffer file %s. Start the producer(s) first, with the same SHARDS!\n", sh->fileName);
+            exit(EXIT_FAILURE);
+        }
+        openBufferFile(&sh->buffer, BUFFER_SIZE/numShards, sh->fileName);
+        if (syncMode == SYNC_MODE_SEM) openSemaphores(sh, i);
+    }
+    if (syncMode == SYNC_MODE_MUTEX) buffer_sync = openBufferSync();
+    if (numShards > 1) {
+        sem_items = openSemaphore(SEMNAME_ITEMS, -1);
+        if (sem_items == SEM_FAILED) handle_error("sem_open items");
+    }
+
     for (i=0; i<NUM_CONSUMERS; ++i) {
         pid_t pid = fork();
         if (pid == -1) {
             handle_error("fork");
         } else if (pid == 0) {
-            consume(i, OPS_PER_CONSUMER);
+            if (logMode) consumeLog(i, OPS_PER_CONSUMER);
+            else consume(i, OPS_PER_CONSUMER);
             _exit(EXIT_SUCCESS);
         }
     }
@@ -113,9 +221,22 @@ int main(int argc, char** argv) {
         if (WEXITSTATUS(status)) handle_error("child crashed");
     }
 
+    printSyncStats(buffer_sync, NUM_OPERATIONS);
     printf("Consumers have terminated. Exiting...\n");
 
-    closeAndDestroySemaphores();
+    if (logMode) {
+        // the log and the offsets stay on disk, for the next run and the other groups
+        log_index_t* x = seglog.index;
+        unsigned long offset = atomic_load(&x->groups[seglog.group].offset);
+        printf("Group %s at offset %lu, %lu records behind, %lu records on disk\n",
+               x->groups[seglog.group].name, offset, atomic_load(&x->end) - offset, atomic_load(&x->end) - x->head);
+        closeLog(&seglog);
+    } else if (buffer_sync != NULL) {
+        destroyBufferSync(buffer_sync);
+    } else {
+        closeAndDestroySemaphores();
+    }
+    for (i=0; i<numShards; ++i) closeBufferFile(&shards[i].buffer);
 
     exit(EXIT_SUCCESS);
 }
@@ -1,4 +1,7 @@
 #include "common.h"
+#include "buffer_sync.h"
+#include "seglog.h"
+#include "../../01/workload.h"
 
 #include <fcntl.h>  // O_CREAT and O_EXCL flags
 #include <semaphore.h>
@@ -8,115 +11,304 @@
 #include <unistd.h>
 #include <sys/wait.h>
 
-sem_t *sem_filled, *sem_empty, *sem_cs;
+shard_t shards[MAX_SHARDS];
+int numShards;
+sem_t* sem_items = NULL;            // sharded buffer only
+buffer_sync_t* buffer_sync = NULL;  // SYNC_MODE=mutex, replaces the semaphores
+buffer_file_t mode;                 // BUFFER_MODE, parsed once
+seglog_t seglog;                    // BUFFER_MODE=log, replaces the buffer file
 
-void initSemaphores() {
-    // delete stale semaphores from a previous crash (if any)
-    sem_unlink(SEMNAME_FILLED);
-    sem_unlink(SEMNAME_EMPTY);
-    sem_unlink(SEMNAME_CS);
+// deletes a stale semaphore from a previous crash (if any) and creates it again
+sem_t* createSemaphore(const char* base, int shard, unsigned int value) {
+    char name[MAX_NAME_LEN];
+    shardName(name, base, shard, numShards);
+    sem_unlink(name);
+    return sem_open(name, O_CREAT | O_EXCL, 0644, value);
+}
 
-    /* We create three named semaphores:
+void initSemaphores(shard_t* sh, int shard, int queued) {
+    /* We create three named semaphores for each shard:
     * - sem_filled to check that our buffer is not empty
-    *   (we need to initialize it to 0)
+    *   (we need to initialize it to the number of queued elements)
     * - sem_empty to check that our buffer is not full
-    *   (we need to initialize it to the buffer's capacity BUFFER_SIZE)
+    *   (we need to initialize it to the free space left in the buffer)
     * - sem_cs to enforce mutual exclusion when accessing the file
     */
 
-    sem_filled = sem_open(SEMNAME_FILLED, O_CREAT | O_EXCL, 0644, 0);
-    if (sem_filled == SEM_FAILED) handle_error("sem_open filled");
+    sh->filled = createSemaphore(SEMNAME_FILLED, shard, queued);
+    if (sh->filled == SEM_FAILED) handle_error("sem_open filled");
 
-    sem_empty = sem_open(SEMNAME_EMPTY, O_CREAT | O_EXCL, 0644, BUFFER_SIZE);
-    if (sem_empty == SEM_FAILED) handle_error("sem_open empty");
+    sh->empty = createSemaphore(SEMNAME_EMPTY, shard, BUFFER_SIZE/numShards - queued);
+    if (sh->empty == SEM_FAILED) handle_error("sem_open empty");
 
-    sem_cs = sem_open(SEMNAME_CS, O_CREAT | O_EXCL, 0644, 1);
-    if (sem_cs == SEM_FAILED) handle_error("sem_open cs");
+    sh->cs = createSemaphore(SEMNAME_CS, shard, 1);
+    if (sh->cs == SEM_FAILED) handle_error("sem_open cs");
 }
 
 void closeSemaphores() {
     /* When the program that controls the producer(s) terminates, we
      * need to close all the the semaphores we previously opened */
 
-    int ret = sem_close(sem_filled);
-    if (ret) handle_error("sem_close filled");
+    int i, ret;
+    for (i=0; i<numShards; ++i) {
+        ret = sem_close(shards[i].filled);
+        if (ret) handle_error("sem_close filled");
+
+        ret = sem_close(shards[i].empty);
+        if (ret) handle_error("sem_close empty");
 
-    ret = sem_close(sem_empty);
-    if (ret) handle_error("sem_close empty");
+        ret = sem_close(shards[i].cs);
+        if (ret) handle_error("sem_close cs");
+    }
 
-    ret = sem_close(sem_cs);
-    if (ret) handle_error("sem_close cs");
+    if (sem_items != NULL && sem_close(sem_items)) handle_error("sem_close items");
 }
 
+wl_config workload_cfg;
+workload wl;    // per process, producers are forked
+
+// generates a number between -MAX_TRANSACTION and +MAX_TRANSACTION
 static inline int performRandomTransaction() {
-    struct timespec pause = {0};
-    pause.tv_nsec = 10*1000000; // 10 ms (10*10^6 ns)
-    nanosleep(&pause, NULL);
+    return wl_transaction(&wl, MAX_TRANSACTION);
+}
 
-    int amount = rand() % (2 * MAX_TRANSACTION);
-    return (amount >= MAX_TRANSACTION) ? (MAX_TRANSACTION-amount-1) : (amount+1);
+// notifies the consumer(s) of the records made visible by a commit
+void postFilled(shard_t* sh, int committed) {
+    while (committed-- > 0) {
+        int ret = sem_post(sh->filled);
+        if (ret) handle_error("sem_post filled");
+        if (sem_items != NULL && sem_post(sem_items)) handle_error("sem_post items");
+    }
+}
+
+/* In durable mode a producer must not sleep on a full buffer, or quit,
+ * while some records are still pending: their slots are taken but the
+ * consumers cannot see them yet. A commit may set the full flag, which the
+ * consumers clear, so it runs under sem_cs (or the mutex) like their reads;
+ * the producers run the transaction outside it, so this waits for a put at
+ * most, not for a transaction. */
+void commitPending() {
+    if (buffer_sync != NULL) {
+        commitSync(buffer_sync, &shards[0].buffer);
+        return;
+    }
+    int i, ret;
+    for (i=0; i<numShards; ++i) {
+        if (shards[i].buffer.commit == NULL) return;
+        ret = sem_wait(shards[i].cs);
+        if (ret) handle_error("sem_wait cs");
+        int committed = commitBuffer(&shards[i].buffer);
+        ret = sem_post(shards[i].cs);
+        if (ret) handle_error("sem_post cs");
+        postFilled(&shards[i], committed);
+    }
+}
+
+/* The producers check the us=T deadline only when they write, so a slow
+ * producer would leave its records invisible for longer than T. While it
+ * waits for them, the main process commits the records that are due,
+ * waking up at the next deadline (or every T if nothing is pending). */
+void waitProducers() {
+    int i, ret, status, running = NUM_PRODUCERS;
+    long commitNs = mode.mode == BUFFER_MODE_DURABLE ? mode.commitNs : 0;
+    while (running > 0) {
+        if (commitNs == 0) {
+            ret = wait(&status);
+        } else {
+            ret = waitpid(-1, &status, WNOHANG);
+            if (ret == 0) {
+                long dueIn = commitNs;
+                for (i=0; i<numShards; ++i) {
+                    long d = commitDueIn(&shards[i].buffer);
+                    if (d >= 0 && d < dueIn) dueIn = d;
+                }
+                if (dueIn == 0) {
+                    commitPending();
+                } else {
+                    struct timespec pause = { dueIn / 1000000000, dueIn % 1000000000 };
+                    nanosleep(&pause, NULL);
+                }
+                continue;
+            }
+        }
+        if (ret == -1) handle_error("wait");
+        if (WEXITSTATUS(status)) handle_error_en(WEXITSTATUS(status), "child crashed");
+        running--;
+    }
 }
 
 void produce(int id, int numOps) {
+    // each producer draws from its own generator, seeded from PRNG_SEED and its id
+    wl_init(&wl, &workload_cfg, PRNG_SEED, id);
+
     int localSum = 0;
+    int next = id % numShards;  // producers go round-robin over the shards
     while (numOps > 0) {
 
+        if (buffer_sync != NULL) {
+            /* A single lock/unlock pair replaces the four semaphore
+             * operations: beginPut waits for a free slot under the lock,
+             * endPut wakes a consumer only if one is sleeping. The lock is
+             * shared with the consumers (and with the main process, which
+             * commits on the us=T deadline), so the transaction runs first. */
+            int value = performRandomTransaction();
+            beginPut(buffer_sync, &shards[0].buffer);
+            int committed = putBuffer(&shards[0].buffer, value);
+            localSum += value;
+            endPut(buffer_sync, committed);
+
+            numOps--;
+            continue;
+        }
+
         /* Before adding an element to the buffer, we have to check that
          * it is not full by using the semaphore sem_empty.
          * We need also to access to the critical section by enforcing
-         * mutual esclusion, which can be achieved using sem_cs. */
+         * mutual esclusion, which can be achieved using sem_cs. The
+         * transaction runs first, for the same reason as in mutex mode:
+         * the main process takes sem_cs to commit on the us=T deadline. */
+
+        int value = performRandomTransaction();
+        shard_t* sh = &shards[next];
+        next = (next + 1) % numShards;
 
-        int ret = sem_wait(sem_empty);
+        int ret = sem_trywait(sh->empty);
+        if (ret && errno == EAGAIN) {
+            commitPending();
+            ret = sem_wait(sh->empty);
+        }
         if (ret) handle_error("sem_wait empty");
 
-        ret = sem_wait(sem_cs);
+        ret = sem_wait(sh->cs);
         if (ret) handle_error("sem_wait cs");
 
         // CRITICAL SECTION
-        int value = performRandomTransaction();
-        writeToBufferFile(value, BUFFER_SIZE, BUFFER_FILENAME);
+        int committed = putBuffer(&sh->buffer, value);
         localSum += value;
 
         /* On leaving the critical section we have to "release" the
          * shared resource via sem_cs, and notify the consumer(s) that
-         * a new element is available using the semaphore sem_filled. */
+         * a new element is available using the semaphore sem_filled
+         * (in durable mode, once per record of the last commit). */
 
-        ret = sem_post(sem_cs);
+        ret = sem_post(sh->cs);
         if (ret) handle_error("sem_post cs");
 
-        ret = sem_post(sem_filled);
-        if (ret) handle_error("sem_post filled");
+        postFilled(sh, committed);
+
+        numOps--;
+    }
+    commitPending();
+
+    int i;
+    unsigned long ops = 0, ns = 0;
+    for (i=0; i<numShards; ++i) {
+        ops += shards[i].buffer.ops;
+        ns += shards[i].buffer.ns;
+        closeBufferFile(&shards[i].buffer);
+    }
+    printf("Producer %d ended. Local sum is %d (%lu ns per buffer operation)\n",
+           id, localSum, ops ? ns/ops : 0);
+    fflush(stdout);    // the child leaves with _exit, which does not flush
+}
 
+/* With BUFFER_MODE=log there is no slot to wait for: the log grows, and
+ * the only critical section is the append itself. */
+void produceLog(int id, int numOps) {
+    wl_init(&wl, &workload_cfg, PRNG_SEED, id);
+
+    int localSum = 0;
+    while (numOps > 0) {
+        int value = performRandomTransaction();
+        appendLog(&seglog, value);
+        localSum += value;
         numOps--;
     }
-    printf("Producer %d ended. Local sum is %d\n", id, localSum);
+    printf("Producer %d ended. Local sum is %d (%lu ns per log operation)\n",
+           id, localSum, seglog.ops ? seglog.ns/seglog.ops : 0);
+    fflush(stdout);    // the child leaves with _exit, which does not flush
+    closeLog(&seglog);
 }
 
 int main(int argc, char** argv) {
-    srand(PRNG_SEED);
-    initFile(BUFFER_SIZE, BUFFER_FILENAME);
-    initSemaphores();
+    // service time of a transaction, from $WORKLOAD (default fixed:10ms)
+    if (wl_config_init(&workload_cfg, NULL)) handle_error_en(EINVAL, "invalid WORKLOAD");
+    int syncMode = parseSyncMode(getenv("SYNC_MODE"));
+    if (syncMode < 0) handle_error_en(EINVAL, "invalid SYNC_MODE");
+    numShards = parseShards(getenv("SHARDS"));
+    if (numShards < 0) handle_error_en(EINVAL, "invalid SHARDS (must divide BUFFER_SIZE)");
+    if (numShards > 1 && syncMode != SYNC_MODE_SEM) handle_error_en(EINVAL, "SHARDS needs SYNC_MODE=sem");
+    if (parseBufferMode(&mode, getenv("BUFFER_MODE"))) handle_error_en(EINVAL, "invalid BUFFER_MODE");
+    int logMode = mode.mode == BUFFER_MODE_LOG;
+    if (logMode && (numShards > 1 || syncMode != SYNC_MODE_SEM))
+        handle_error_en(EINVAL, "BUFFER_MODE=log has its own synchronization, unset SHARDS and SYNC_MODE");
+
+    // elements left by a previous run are kept, not thrown away
+    int i, queued = 0;
+    if (logMode) {
+        unsigned long backlog = openLog(&seglog, 1, mode.segmentRecords);
+        if (backlog) printf("Resuming from %s with %lu records on disk\n", LOG_FILENAME, backlog);
+        numShards = 0;
+    }
+    for (i=0; i<numShards; ++i) {
+        shard_t* sh = &shards[i];
+        shardName(sh->fileName, BUFFER_FILENAME, i, numShards);
+        int q = initFile(BUFFER_SIZE/numShards, sh->fileName);
+        if (q) printf("Resuming from %s with %d queued elements\n", sh->fileName, q);
+        openBufferFile(&sh->buffer, BUFFER_SIZE/numShards, sh->fileName);
+        if (syncMode == SYNC_MODE_SEM) initSemaphores(sh, i, q);
+        queued += q;
+    }
+    if (syncMode == SYNC_MODE_MUTEX) buffer_sync = createBufferSync(queued);
+    if (numShards > 1) {
+        sem_items = createSemaphore(SEMNAME_ITEMS, -1, queued);
+        if (sem_items == SEM_FAILED) handle_error("sem_open items");
+    }
+    // the consumer(s) can start from now on; flush before the children copy the buffer
+    if (logMode) printf("Producers started (BUFFER_MODE=log)\n");
+    else printf("Producers started (SYNC_MODE=%s, %d shards)\n", buffer_sync != NULL ? "mutex" : "sem", numShards);
+    fflush(stdout);
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    int i, ret;
     for (i=0; i<NUM_PRODUCERS; ++i) {
         pid_t pid = fork();
         if (pid == -1) {
             handle_error("fork");
         } else if (pid == 0) {
-            produce(i, OPS_PER_PRODUCER);
+            if (logMode) produceLog(i, OPS_PER_PRODUCER);
+            else produce(i, OPS_PER_PRODUCER);
             _exit(EXIT_SUCCESS);
         }
     }
 
-    for (i=0; i<NUM_PRODUCERS; ++i) {
-        int status;
-        ret = wait(&status);
-        if (ret == -1) handle_error("wait");
-        if (WEXITSTATUS(status)) handle_error_en(WEXITSTATUS(status), "child crashed");
+    waitProducers();
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (shards[0].buffer.commit != NULL) {
+        buffer_commit_t c = {0};
+        for (i=0; i<numShards; ++i) {
+            c.records += shards[i].buffer.commit->records;
+            c.commits += shards[i].buffer.commit->commits;
+            c.syncs += shards[i].buffer.commit->syncs;
+        }
+        printf("%lu records in %lu commits (%.1f records per commit), %lu fdatasync calls\n",
+               c.records, c.commits, c.commits ? (double)c.records/c.commits : 0.0, c.syncs);
+        printf("%.0f durable records/s\n", c.records / seconds);
     }
 
+    printSyncStats(buffer_sync, NUM_OPERATIONS);
     printf("Producers have terminated. Exiting...\n");
-    closeSemaphores();
+    if (logMode) {
+        printf("%.0f records/s appended\n", OPS_PER_PRODUCER*NUM_PRODUCERS / seconds);
+        closeLog(&seglog);
+    }
+    if (buffer_sync != NULL) closeBufferSync(buffer_sync);
+    else closeSemaphores();
+    for (i=0; i<numShards; ++i) closeBufferFile(&shards[i].buffer);
 
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,170 @@
+#include "common.h"
+#include "seglog.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG_INDEX_FILENAME  LOG_FILENAME ".index"
+
+static inline unsigned long logClock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000UL + ts.tv_nsec;
+}
+
+static void segmentName(char* dst, unsigned long first) {
+    snprintf(dst, MAX_NAME_LEN, "%s.%010lu", LOG_FILENAME, first);
+}
+
+/* Returns the number of records on disk. The producer (create != 0) makes
+ * an empty log if there is none, and resets the locks of an existing one:
+ * a process that died holding them must not block the new run. */
+unsigned long openLog(seglog_t* l, int create, long segmentRecords) {
+    int fd = open(LOG_INDEX_FILENAME, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd == -1) handle_error("openLog open index");
+
+    struct stat st;
+    if (fstat(fd, &st)) handle_error("openLog fstat index");
+    int empty = st.st_size == 0;
+    if (empty && !create) handle_error_en(ENOENT, "openLog: empty log index");
+    if (!empty && st.st_size != sizeof(log_index_t)) handle_error_en(EINVAL, "openLog: damaged log index");
+    if (empty && ftruncate(fd, sizeof(log_index_t))) handle_error("openLog ftruncate index");
+
+    log_index_t* index = mmap(NULL, sizeof(log_index_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (index == MAP_FAILED) handle_error("openLog mmap index");
+    if (close(fd)) handle_error("openLog close index");
+
+    if (empty) {
+        memset(index, 0, sizeof(log_index_t));
+        index->magic = LOG_MAGIC;
+        index->version = LOG_VERSION;
+        index->segmentRecords = segmentRecords;
+    } else if (index->magic != LOG_MAGIC || index->version != LOG_VERSION || index->segmentRecords == 0) {
+        handle_error_en(EINVAL, "openLog: damaged log index");
+    }
+
+    if (create) {
+        int i;
+        fsem_init(&index->appendLock, 1, 1);
+        fec_init(&index->appended, 1);
+        for (i=0; i<LOG_MAX_GROUPS; ++i) fsem_init(&index->groups[i].lock, 1, 1);
+    }
+
+    l->index = index;
+    l->fd = -1;
+    l->segment = 0;
+    l->group = -1;
+    l->ops = l->ns = 0;
+    return atomic_load(&index->end) - index->head;
+}
+
+void closeLog(seglog_t* l) {
+    if (l->fd != -1 && close(l->fd)) handle_error("closeLog close segment");
+    l->fd = -1;
+    if (munmap(l->index, sizeof(log_index_t))) handle_error("closeLog munmap index");
+}
+
+// finds the group or registers it; a new group starts from the oldest record on disk
+void joinLog(seglog_t* l, const char* group) {
+    log_index_t* x = l->index;
+    int i, slot = -1;
+    fsem_wait(&x->appendLock);
+    for (i=0; i<LOG_MAX_GROUPS; ++i) {
+        if (strncmp(x->groups[i].name, group, LOG_GROUP_LEN) == 0) break;
+        if (slot == -1 && x->groups[i].name[0] == '\0') slot = i;
+    }
+    if (i == LOG_MAX_GROUPS && slot != -1) {
+        i = slot;
+        snprintf(x->groups[i].name, LOG_GROUP_LEN, "%s", group);
+        atomic_store(&x->groups[i].offset, x->head);
+    }
+    fsem_post(&x->appendLock);
+    if (i == LOG_MAX_GROUPS) handle_error_en(ENOSPC, "joinLog: too many consumer groups");
+    l->group = i;
+}
+
+// keeps in l->fd the segment holding record pos
+static void seekSegment(seglog_t* l, unsigned long pos, int flags) {
+    unsigned long first = pos - pos % l->index->segmentRecords;
+    if (l->fd != -1 && l->segment == first) return;
+    if (l->fd != -1 && close(l->fd)) handle_error("close segment");
+
+    char name[MAX_NAME_LEN];
+    segmentName(name, first);
+    l->fd = open(name, flags, 0644);
+    if (l->fd == -1) handle_error("open segment");
+    l->segment = first;
+}
+
+void appendLog(seglog_t* l, int value) {
+    log_index_t* x = l->index;
+    unsigned long start = logClock();
+
+    fsem_wait(&x->appendLock);
+    unsigned long pos = atomic_load_explicit(&x->end, memory_order_relaxed);
+    seekSegment(l, pos, O_WRONLY | O_CREAT);
+    if (pwrite(l->fd, &value, sizeof(int), (pos - l->segment)*sizeof(int)) != sizeof(int))
+        handle_error("appendLog pwrite");
+    // the record is in the page cache before a consumer can see the new end
+    atomic_store_explicit(&x->end, pos + 1, memory_order_release);
+    fsem_post(&x->appendLock);
+    fec_notify(&x->appended);
+
+    l->ns += logClock() - start;
+    l->ops++;
+}
+
+// deletes the segments that every group has read
+static void trimLog(seglog_t* l) {
+    log_index_t* x = l->index;
+    unsigned long min = atomic_load(&x->end);
+    int i;
+    fsem_wait(&x->appendLock);
+    for (i=0; i<LOG_MAX_GROUPS; ++i) {
+        unsigned long offset = atomic_load(&x->groups[i].offset);
+        if (x->groups[i].name[0] != '\0' && offset < min) min = offset;
+    }
+    while (x->head + x->segmentRecords <= min) {
+        char name[MAX_NAME_LEN];
+        segmentName(name, x->head);
+        if (unlink(name) && errno != ENOENT) handle_error("trimLog unlink");
+        x->head += x->segmentRecords;
+    }
+    fsem_post(&x->appendLock);
+}
+
+/* Reads the next record of the group, waiting for the producers if the
+ * group has read everything. The other consumers of the group wait on its
+ * lock meanwhile, as they would read the same record. */
+int readLog(seglog_t* l) {
+    log_index_t* x = l->index;
+    log_group_t* g = &x->groups[l->group];
+    int value;
+
+    fsem_wait(&g->lock);
+    unsigned long pos = atomic_load_explicit(&g->offset, memory_order_relaxed);
+    while (pos >= atomic_load_explicit(&x->end, memory_order_acquire)) {
+        unsigned int key = fec_prepare_wait(&x->appended);
+        if (pos < atomic_load_explicit(&x->end, memory_order_acquire)) {
+            fec_cancel_wait(&x->appended);
+            break;
+        }
+        fec_wait(&x->appended, key);
+    }
+
+    unsigned long start = logClock();
+    seekSegment(l, pos, O_RDONLY);
+    if (pread(l->fd, &value, sizeof(int), (pos - l->segment)*sizeof(int)) != sizeof(int))
+        handle_error("readLog pread");
+    atomic_store(&g->offset, pos + 1);
+    fsem_post(&g->lock);
+
+    if ((pos + 1) % x->segmentRecords == 0) trimLog(l);
+    l->ns += logClock() - start;
+    l->ops++;
+    return value;
+}
@@ -0,0 +1,69 @@
+#ifndef SEGLOG_H
+#define SEGLOG_H
+
+#include "../../01/futex_sync.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Append-only log that replaces the circular buffer file with BUFFER_MODE=log.
+ *
+ * Producers append records at the end of the current segment file,
+ * LOG_FILENAME.<first record>, and start a new segment every
+ * segmentRecords records, so the file is written sequentially and the
+ * backlog is not bounded by BUFFER_SIZE. The shared state lives in a small
+ * index file mapped by every process: the end of the log, the first record
+ * still on disk and the offset of each consumer group.
+ *
+ * The consumers of a group (LOG_GROUP, default "default") share its offset,
+ * so each record is read by one of them; every group reads the whole
+ * stream. A segment is deleted when all the groups are past it. Locks and
+ * waits use the process-shared futex primitives of ../../01/futex_sync.h
+ * kept in the index; the producer reinitializes them when it starts, as it
+ * recreates the semaphores of the other modes. */
+
+#define LOG_FILENAME        "bufferlog"
+#define LOG_MAGIC           0x474f4c53  // "SLOG"
+#define LOG_VERSION         1
+#ifndef LOG_SEGMENT_RECORDS
+#define LOG_SEGMENT_RECORDS 1024        // default records per segment (4 KiB)
+#endif
+#define LOG_MAX_GROUPS      8
+#define LOG_GROUP_LEN       32
+
+typedef struct {
+    char name[LOG_GROUP_LEN];   // empty if the slot is free
+    fsem_t lock;                // serializes the consumers of the group
+    atomic_ulong offset;        // next record to read
+} log_group_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t segmentRecords;
+    uint32_t padding;
+    fsem_t appendLock;          // also protects head and the group table
+    fec_t appended;             // notified when end advances
+    atomic_ulong end;           // records appended so far
+    unsigned long head;         // first record of the oldest segment on disk
+    log_group_t groups[LOG_MAX_GROUPS];
+} log_index_t;
+
+// per process: the mapping of the index and the segment it has open
+typedef struct {
+    log_index_t* index;
+    int fd;
+    unsigned long segment;      // first record of the segment open in fd
+    int group;                  // consumers only
+    unsigned long ops;          // operations and time spent in them
+    unsigned long ns;
+} seglog_t;
+
+// methods defined in seglog.c
+unsigned long openLog(seglog_t* l, int create, long segmentRecords);
+void closeLog(seglog_t* l);
+void joinLog(seglog_t* l, const char* group);
+void appendLog(seglog_t* l, int value);
+int readLog(seglog_t* l);
+
+#endif
@@ -14,11 +14,41 @@
 
 #define SHM_NAME "/shmem-example"
 
+// default number of ints of the data array, the size is computed at runtime
 #define NUM 3
+#define PRINT_MAX 16        // larger arrays are summed instead of printed
+#define MAX_WORKERS 64      // fork-join workers, each on a slice of the array
 
-#define SIZE (NUM * sizeof(int))
+// kernels and speedup modes: benchmarks of the worker's kernels and of the fork-join
+#define KERNELS_NUM         (64UL << 20)    // 256 MiB of ints
+#define KERNELS_REPEATS     5
 
 #define SEM_NAME_REQ         "/mysemreq"
 #define SEM_NAME_WRK         "/mysemwrk"
 
+// service mode: a long-lived pool of workers serving many requesters
+#define SERVICE_SHM_NAME        "/shmem-service"
+#define SERVICE_PAYLOAD         NUM     // ints transformed by a request
+#define SERVICE_MAX_REQUESTERS  64
+#define SERVICE_MAX_WORKERS     64
+#define SERVICE_REQUESTERS      4       // defaults of the command line
+#define SERVICE_WORKERS         2
+#define SERVICE_REQUESTS        10000   // per requester
+
+// seqlock mode: one writer publishing the data to many lock-free readers
+#define SEQLOCK_SHM_NAME        "/shmem-seqlock"
+#define SEQLOCK_MAX_READERS     64
+#define SEQLOCK_MAX_PAYLOAD     4096    // ints
+#define SEQLOCK_READERS         4       // defaults of the command line
+#define SEQLOCK_MILLISECONDS    1000
+#define SEQLOCK_PAYLOAD         64
+#define SEQLOCK_PAUSE           0       // us between two updates
+
+// methods defined in service.c and seqlock.c
+int serveService(int workers, int verbose);
+int requestService(int requests, int verbose);
+int stopService();
+int runService(int requesters, int workers, int requests);
+int runSeqlock(int readers, int milliseconds, int len, int pause);
+
 #endif
@@ -0,0 +1,262 @@
+#include "common.h"
+#include "kernels.h"
+#include "../../01/performance.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+static int alwaysSupported(void) {
+    return 1;
+}
+
+/* Scalar and auto-vectorized variants: the same source, compiled with and
+ * without the vectorizer. Unsigned arithmetic makes overflow wrap around. */
+
+#define PLAIN_KERNELS(variant, attr) \
+    attr static void variant##Square(int *data, size_t n) { \
+        uint32_t *d = (uint32_t *)data; \
+        size_t i; \
+        for (i = 0; i < n; ++i) d[i] = d[i] * d[i]; \
+    } \
+    attr static void variant##Scale(int *data, size_t n, int k) { \
+        uint32_t *d = (uint32_t *)data; \
+        size_t i; \
+        for (i = 0; i < n; ++i) d[i] = d[i] * (uint32_t)k; \
+    } \
+    attr static void variant##Add(int *data, const int *src, size_t n) { \
+        uint32_t *d = (uint32_t *)data; \
+        const uint32_t *s = (const uint32_t *)src; \
+        size_t i; \
+        for (i = 0; i < n; ++i) d[i] = d[i] + s[i]; \
+    } \
+    attr static long long variant##Sum(const int *data, size_t n) { \
+        long long sum = 0; \
+        size_t i; \
+        for (i = 0; i < n; ++i) sum += data[i]; \
+        return sum; \
+    }
+
+PLAIN_KERNELS(scalar, __attribute__((optimize("no-tree-vectorize"))))
+PLAIN_KERNELS(auto, __attribute__((optimize("O3", "tree-vectorize"))))
+
+#ifdef HAVE_X86_KERNELS
+
+static int sse2Supported(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+static int avx2Supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+// SSE2 has no 32-bit mullo: multiply the even and the odd lanes as 64-bit products
+__attribute__((target("sse2")))
+static inline __m128i mullo_sse2(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__attribute__((target("sse2")))
+static void sse2Square(int *data, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((__m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)(data + i), mullo_sse2(v, v));
+    }
+    scalarSquare(data + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void sse2Scale(int *data, size_t n, int k) {
+    __m128i vk = _mm_set1_epi32(k);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((__m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)(data + i), mullo_sse2(v, vk));
+    }
+    scalarScale(data + i, n - i, k);
+}
+
+__attribute__((target("sse2")))
+static void sse2Add(int *data, const int *src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((__m128i *)(data + i));
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(data + i), _mm_add_epi32(v, s));
+    }
+    scalarAdd(data + i, src + i, n - i);
+}
+
+// the 32-bit lanes are sign-extended to 64 bits, so the sum cannot overflow
+__attribute__((target("sse2")))
+static long long sse2Sum(const int *data, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i sign = _mm_srai_epi32(v, 31);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+    }
+    long long lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return lanes[0] + lanes[1] + scalarSum(data + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2Square(int *data, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((__m256i *)(data + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_mullo_epi32(v, v));
+    }
+    scalarSquare(data + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2Scale(int *data, size_t n, int k) {
+    __m256i vk = _mm256_set1_epi32(k);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((__m256i *)(data + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_mullo_epi32(v, vk));
+    }
+    scalarScale(data + i, n - i, k);
+}
+
+__attribute__((target("avx2")))
+static void avx2Add(int *data, const int *src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((__m256i *)(data + i));
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_add_epi32(v, s));
+    }
+    scalarAdd(data + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static long long avx2Sum(const int *data, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalarSum(data + i, n - i);
+}
+
+#endif
+
+// from the narrowest to the widest
+const kernel_t kernels[] = {
+    { "scalar", alwaysSupported, scalarSquare, scalarScale, scalarAdd, scalarSum },
+    { "auto", alwaysSupported, autoSquare, autoScale, autoAdd, autoSum },
+#ifdef HAVE_X86_KERNELS
+    { "sse2", sse2Supported, sse2Square, sse2Scale, sse2Add, sse2Sum },
+    { "avx2", avx2Supported, avx2Square, avx2Scale, avx2Add, avx2Sum },
+#endif
+};
+const int num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+// the named variant, or the widest one supported if name is NULL; NULL if unknown or unsupported
+const kernel_t *kernelSelect(const char *name) {
+    int i;
+    if (name == NULL || *name == '\0') {
+        for (i = num_kernels - 1; i > 0 && !kernels[i].supported(); --i);
+        return &kernels[i];
+    }
+    for (i = 0; i < num_kernels; ++i) {
+        if (strcmp(kernels[i].name, name) == 0) return kernels[i].supported() ? &kernels[i] : NULL;
+    }
+    return NULL;
+}
+
+static void fill(int *data, const int *src, size_t n) {
+    size_t i;
+    for (i = 0; i < n; ++i) data[i] = src[i];
+}
+
+/* Runs every kernel of every supported variant over num ints of a shared
+ * mapping, as the worker would, and prints the best of repeats runs in GB/s
+ * (bytes read plus bytes written). The results are checked against the
+ * scalar variant. */
+int runKernelBench(size_t num, int repeats) {
+    size_t size = num * sizeof(int);
+
+    shm_unlink(SHM_NAME);
+    int fd = shm_open(SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) handle_error("shm_open error");
+    // data, a second operand for add and a pristine copy to restart from
+    if (ftruncate(fd, 3 * size) == -1) handle_error("ftruncate error");
+    int *data = mmap(0, 3 * size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) handle_error("mmap error");
+    if (close(fd) == -1) handle_error("close error");
+    int *src = data + num, *init = data + 2 * num;
+
+    size_t i;
+    for (i = 0; i < num; ++i) {
+        init[i] = (int)(i % 2001) - 1000;
+        src[i] = (int)(i % 7);
+    }
+
+    printf("kernels: %zu ints (%.1f MiB), best of %d runs, GB/s\n", num, size / 1048576.0, repeats);
+    printf("%-8s %10s %10s %10s %10s\n", "variant", "square", "scale", "add", "sum");
+
+    long long expected[4] = { 0 };
+    int k, op, r;
+    for (k = 0; k < num_kernels; ++k) {
+        const kernel_t *kn = &kernels[k];
+        if (!kn->supported()) {
+            printf("%-8s not supported by this CPU\n", kn->name);
+            continue;
+        }
+        double gbs[4];
+        for (op = 0; op < 4; ++op) {
+            unsigned long best = 0;
+            long long check = 0;
+            for (r = 0; r < repeats; ++r) {
+                fill(data, init, num);
+                unsigned long start = now_ns();
+                switch (op) {
+                    case 0: kn->square(data, num); break;
+                    case 1: kn->scale(data, num, 3); break;
+                    case 2: kn->add(data, src, num); break;
+                    case 3: check = kn->sum(data, num); break;
+                }
+                unsigned long ns = now_ns() - start;
+                if (r == 0 || ns < best) best = ns;
+            }
+            if (op != 3) check = scalarSum(data, num);
+            if (k == 0) {
+                expected[op] = check;
+            } else if (check != expected[op]) {
+                fprintf(stderr, "kernels: %s gives a different result than scalar\n", kn->name);
+                exit(EXIT_FAILURE);
+            }
+            // square and scale read and write data, add also reads src, sum only reads
+            size_t bytes = op == 2 ? 3 * size : op == 3 ? size : 2 * size;
+            gbs[op] = best ? (double)bytes / best : 0.0;
+        }
+        printf("%-8s %10.2f %10.2f %10.2f %10.2f\n", kn->name, gbs[0], gbs[1], gbs[2], gbs[3]);
+    }
+    const kernel_t *chosen = kernelSelect(getenv("KERNEL"));
+    printf("kernels: the worker uses %s\n", chosen != NULL ? chosen->name : "none (invalid KERNEL)");
+
+    if (munmap(data, 3 * size) == -1) handle_error("munmap error");
+    if (shm_unlink(SHM_NAME)) handle_error("shm_unlink error");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+
+/*
+ * Element-wise kernels of the worker, each in several variants:
+ * - scalar   a plain loop with vectorization disabled
+ * - auto     the same loop, vectorized by the compiler at -O3
+ * - sse2     explicit SSE2 intrinsics (x86 only)
+ * - avx2     explicit AVX2 intrinsics (x86 only)
+ * Arithmetic wraps around as on unsigned ints, so every variant gives the
+ * same result on any input. kernelSelect(NULL) picks the widest variant the
+ * CPU supports (CPUID), which can be overridden with the KERNEL environment
+ * variable.
+ */
+typedef struct {
+    const char *name;
+    int (*supported)(void);
+    void (*square)(int *data, size_t n);            // data[i] = data[i]^2
+    void (*scale)(int *data, size_t n, int k);      // data[i] = data[i]*k
+    void (*add)(int *data, const int *src, size_t n);   // data[i] += src[i]
+    long long (*sum)(const int *data, size_t n);
+} kernel_t;
+
+extern const kernel_t kernels[];
+extern const int num_kernels;
+
+const kernel_t *kernelSelect(const char *name);
+int runKernelBench(size_t num, int repeats);
+
+#endif
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "kernels.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -10,75 +11,108 @@
 #include <sys/wait.h>
 #include <semaphore.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "../../01/performance.h"
 
-// data array
+// data array, of num ints (size bytes) set from the command line
 int *data;
+size_t num = NUM, size;
 int fd;
 sem_t *sem_worker, *sem_request;
+const kernel_t *kernel;     // variant of the worker's kernel, by CPUID or $KERNEL
+atomic_int *remaining;      // workers still busy, in a mapping shared by the forked processes
+int verbose = 1;
 
-int request() {
+/* The array is split into one contiguous slice per worker. The slices start
+ * on a page boundary (the mapping is page aligned), so two workers never
+ * write to the same page or cache line; the last slices may be empty. */
+static void slice(int id, int workers, size_t *lo, size_t *hi) {
+    size_t per_page = sysconf(_SC_PAGESIZE) / sizeof(int);
+    size_t chunk = (num + workers - 1) / workers;
+    chunk = (chunk + per_page - 1) / per_page * per_page;
+    *lo = (size_t)id * chunk < num ? (size_t)id * chunk : num;
+    *hi = *lo + chunk < num ? *lo + chunk : num;
+}
+
+// returns the time from the start of the workers to the end of the last one
+unsigned long request(int workers) {
 
     // map the shared memory in the data array
-    if ((data = (int *)mmap(0, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) handle_error("mmap error");
+    if ((data = (int *)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) handle_error("mmap error");
 
-    printf("request: mapped address: %p\n", data);
+    if (verbose) printf("request: mapped address: %p\n", data);
 
-    int i;
-    for (i = 0; i < NUM; ++i){
+    size_t i;
+    for (i = 0; i < num; ++i){
         data[i] = i;
     }
 
-    printf("request: data generated\n");
+    if (verbose) printf("request: data generated\n");
     
-    // signal the worker that it can start the elaboration and wait it has terminated
-    if (sem_post(sem_worker) != 0) handle_error("sem_post error, sem: sem_worker");
+    /* signal the workers that they can start the elaboration and wait until
+     * all of them have terminated: the last one to finish wakes us up */
+    unsigned long start = now_ns();
+    atomic_store(remaining, workers);
+    for (i = 0; i < workers; ++i) {
+        if (sem_post(sem_worker) != 0) handle_error("sem_post error, sem: sem_worker");
+    }
     if (sem_wait(sem_request) != 0) handle_error("sem_wait error, sem: sem_request");
+    unsigned long ns = now_ns() - start;
 
-    printf("request: acquire updated data\n");
-    printf("request: updated data:\n");
-
-    for (i = 0; i < NUM; ++i){
-        printf("%d\n", data[i]);
+    if (verbose) {
+        printf("request: acquire updated data (%d workers, %.3f ms)\n", workers, ns / 1e6);
+        if (num <= PRINT_MAX) {
+            printf("request: updated data:\n");
+            for (i = 0; i < num; ++i){
+                printf("%d\n", data[i]);
+            }
+        } else {
+            // too many to print, a checksum will do
+            printf("request: sum of the updated data: %lld\n", kernel->sum(data, num));
+        }
     }
     
     // release resources
-    if (munmap(data, SIZE) == -1) handle_error("munmap error");
+    if (munmap(data, size) == -1) handle_error("munmap error");
 
-    return EXIT_SUCCESS;
+    return ns;
 }
 
-int work() {
+int work(int id, int workers) {
     
     // map the shared memory in the data array
-    if ((data = (int *)mmap(0, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) handle_error("mmap error");
+    if ((data = (int *)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) handle_error("mmap error");
     
-    printf("worker: mapped address: %p\n", data);
+    if (verbose) printf("worker %d: mapped address: %p\n", id, data);
     
     // wait that the request() process generated data
     if (sem_wait(sem_worker) != 0) handle_error("sem_wait error, sem: sem_worker");
 
-    printf("worker: waiting initial data\n");
-    printf("worker: initial data acquired\n");
-    printf("worker: update data\n");
+    size_t lo, hi;
+    slice(id, workers, &lo, &hi);
+    if (verbose) printf("worker %d: update data [%zu, %zu) (%s kernel)\n", id, lo, hi, kernel->name);
     
-    int i;
-    for (i = 0; i < NUM; ++i){
-        data[i] = data[i] * data[i];
-    }
+    unsigned long start = now_ns();
+    kernel->square(data + lo, hi - lo);
+    unsigned long ns = now_ns() - start;
 
-    printf("worker: release updated data\n");
+    if (verbose) printf("worker %d: release updated data (%.2f GB/s)\n", id, ns ? 2.0 * (hi - lo) * sizeof(int) / ns : 0.0);
     
-    // signal the requester that elaboration terminated
-    if (sem_post(sem_request) != 0) handle_error("sem_post error, sem: sem_request");
+    // the last worker to finish signals the requester that elaboration terminated
+    if (atomic_fetch_sub(remaining, 1) == 1) {
+        if (sem_post(sem_request) != 0) handle_error("sem_post error, sem: sem_request");
+    }
     
     // release resources
-    if (munmap(data, SIZE) == -1) handle_error("munmap error");
+    if (munmap(data, size) == -1) handle_error("munmap error");
 
     return EXIT_SUCCESS;
 }
 
-int main(int argc, char **argv) {
-    
+void openResources() {
+
     // create and open the needed resources
     sem_unlink(SEM_NAME_REQ);
     sem_unlink(SEM_NAME_WRK);
@@ -94,28 +128,16 @@ int main(int argc, char **argv) {
     fd = shm_open(SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
     if (fd < 0) handle_error("shm_open error");
 
-    if (ftruncate(fd, SIZE) == -1) handle_error ("ftruncate error");
+    if (ftruncate(fd, size) == -1) handle_error ("ftruncate error");
 
-    int ret;
-    pid_t pid = fork();
-    if (pid == -1){
-        handle_error("main: fork");
-    }
-    else if (pid == 0){
-        work();
-        _exit(EXIT_SUCCESS);
-    }
+    remaining = mmap(0, sizeof(atomic_int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (remaining == MAP_FAILED) handle_error("mmap error");
+}
+
+void closeResources() {
 
-    request();
-    int status;
-    ret = wait(&status);
-    if (ret == -1)
-        handle_error("main: wait");
-    if (WEXITSTATUS(status))
-        handle_error_en(WEXITSTATUS(status), "request() crashed");
-    
     // close and release resources
-    ret = sem_close(sem_worker);
+    int ret = sem_close(sem_worker);
     if (ret) handle_error("sem_close error, sem: sem_worker");
     ret = sem_close(sem_request);
     if (ret) handle_error("sem_close error, sem: sem_request");
@@ -131,5 +153,127 @@ int main(int argc, char **argv) {
     ret = shm_unlink(SHM_NAME);
     if (ret) handle_error("shm_unlink error");
 
+    ret = munmap(remaining, sizeof(atomic_int));
+    if (ret == -1) handle_error("munmap error");
+}
+
+// forks the workers, performs one request and waits for them
+unsigned long forkJoin(int workers) {
+    int i, ret;
+    fflush(stdout);     // or the children print again what is still buffered
+    for (i = 0; i < workers; ++i) {
+        pid_t pid = fork();
+        if (pid == -1){
+            handle_error("main: fork");
+        }
+        else if (pid == 0){
+            work(i, workers);
+            fflush(stdout);     // _exit does not flush, and the output may be a pipe
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    unsigned long ns = request(workers);
+    for (i = 0; i < workers; ++i) {
+        int status;
+        ret = wait(&status);
+        if (ret == -1)
+            handle_error("main: wait");
+        if (WEXITSTATUS(status))
+            handle_error_en(WEXITSTATUS(status), "work() crashed");
+    }
+    return ns;
+}
+
+/* Speedup of the fork-join request over 1, 2, 4, ... workers, up to
+ * maxWorkers: the best of repeats requests for each number of workers. */
+int runSpeedup(int maxWorkers, int repeats) {
+    verbose = 0;
+    openResources();
+    printf("speedup: %zu ints (%.1f MiB), %s kernel, best of %d runs\n",
+           num, size / 1048576.0, kernel->name, repeats);
+    printf("%8s %10s %10s %8s\n", "workers", "ms", "GB/s", "speedup");
+
+    unsigned long base = 0;
+    int workers = 1;
+    while (1) {
+        unsigned long best = 0;
+        int r;
+        for (r = 0; r < repeats; ++r) {
+            unsigned long ns = forkJoin(workers);
+            if (r == 0 || ns < best) best = ns;
+        }
+        if (workers == 1) base = best;
+        printf("%8d %10.3f %10.2f %8.2f\n", workers, best / 1e6, 2.0 * size / best, (double)base / best);
+
+        if (workers == maxWorkers) break;
+        workers = workers * 2 < maxWorkers ? workers * 2 : maxWorkers;
+    }
+
+    closeResources();
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+
+    /* usage: req_wrk [once [num] [workers]]
+     *        req_wrk speedup [num] [max workers] [repeats]
+     *        req_wrk service [requesters] [workers] [requests per requester]
+     *        req_wrk service serve [workers] | request [requests] | stop
+     *        req_wrk seqlock [readers] [milliseconds] [num] [writer pause us]
+     *        req_wrk kernels [num] [repeats] */
+    kernel = kernelSelect(getenv("KERNEL"));
+    if (kernel == NULL) {
+        fprintf(stderr, "Unknown or unsupported KERNEL %s\n", getenv("KERNEL"));
+        exit(EXIT_FAILURE);
+    }
+    int speedup = argc > 1 && strcmp(argv[1], "speedup") == 0;
+    if (argc > 2 && strcmp(argv[1], "service") == 0 && strcmp(argv[2], "serve") == 0) {
+        return serveService(argc > 3 ? atoi(argv[3]) : SERVICE_WORKERS, 1);
+    } else if (argc > 2 && strcmp(argv[1], "service") == 0 && strcmp(argv[2], "request") == 0) {
+        return requestService(argc > 3 ? atoi(argv[3]) : SERVICE_REQUESTS, 1);
+    } else if (argc > 2 && strcmp(argv[1], "service") == 0 && strcmp(argv[2], "stop") == 0) {
+        return stopService();
+    } else if (argc > 1 && strcmp(argv[1], "service") == 0) {
+        return runService(argc > 2 ? atoi(argv[2]) : SERVICE_REQUESTERS,
+                          argc > 3 ? atoi(argv[3]) : SERVICE_WORKERS,
+                          argc > 4 ? atoi(argv[4]) : SERVICE_REQUESTS);
+    } else if (argc > 1 && strcmp(argv[1], "seqlock") == 0) {
+        return runSeqlock(argc > 2 ? atoi(argv[2]) : SEQLOCK_READERS,
+                          argc > 3 ? atoi(argv[3]) : SEQLOCK_MILLISECONDS,
+                          argc > 4 ? atoi(argv[4]) : SEQLOCK_PAYLOAD,
+                          argc > 5 ? atoi(argv[5]) : SEQLOCK_PAUSE);
+    } else if (argc > 1 && strcmp(argv[1], "kernels") == 0) {
+        return runKernelBench(argc > 2 ? strtoull(argv[2], NULL, 10) : KERNELS_NUM,
+                              argc > 3 ? atoi(argv[3]) : KERNELS_REPEATS);
+    } else if (argc > 1 && strcmp(argv[1], "once") != 0 && !speedup) {
+        fprintf(stderr, "Syntax: %s [once [num] [workers]]\n"
+                        "        %s speedup [num] [max workers] [repeats]\n"
+                        "        %s service [requesters] [workers] [requests per requester]\n"
+                        "        %s service serve [workers] | request [requests] | stop\n"
+                        "        %s seqlock [readers] [milliseconds] [num] [writer pause us]\n"
+                        "        %s kernels [num] [repeats]\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (speedup) num = KERNELS_NUM;
+    if (argc > 2) num = strtoull(argv[2], NULL, 10);
+    if (num == 0 || num > SIZE_MAX / sizeof(int)) {
+        fprintf(stderr, "Invalid number of ints\n");
+        exit(EXIT_FAILURE);
+    }
+    size = num * sizeof(int);
+
+    int workers = argc > 3 ? atoi(argv[3]) : speedup ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    if (workers < 1 || workers > MAX_WORKERS) {
+        fprintf(stderr, "Between 1 and %d workers\n", MAX_WORKERS);
+        exit(EXIT_FAILURE);
+    }
+    if (speedup) return runSpeedup(workers, argc > 4 ? atoi(argv[4]) : KERNELS_REPEATS);
+
+    openResources();
+    forkJoin(workers);
+    closeResources();
+
+    fflush(stdout);
     _exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
@@ -0,0 +1,184 @@
+#include "common.h"
+#include "../../01/performance.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Seqlock publication of the data: one writer keeps updating the array in
+ * the shared segment while any number of reader processes take snapshots of
+ * it, without a lock and without a syscall. The writer makes the sequence
+ * counter odd before touching the data and even again afterwards; a reader
+ * copies the data between two reads of the counter and retries if it was odd
+ * or has changed, since the writer may have been halfway through an update.
+ * Readers never write to the shared segment while reading, so they do not
+ * slow down each other or the writer.
+ *
+ * The data is read and written with relaxed atomics, so the race between the
+ * copy and an update is well defined; the fences order them with respect to
+ * the counter.
+ */
+
+typedef struct {
+    unsigned long reads, retries, spins;
+} __attribute__((aligned(64))) seqlock_reader_t;
+
+typedef struct {
+    atomic_uint seq;            // odd while the writer is updating the data
+    atomic_int stop;            // set by the main process at the end of the run
+    unsigned long updates;      // written by the writer when it leaves
+    int len;                    // ints of data in use
+    atomic_int data[SEQLOCK_MAX_PAYLOAD] __attribute__((aligned(64)));
+    seqlock_reader_t readers[SEQLOCK_MAX_READERS];
+} seqlock_t;
+
+seqlock_t *seqlock;
+
+/* One update publishes generation gen: data[i] = gen + i, so a reader can
+ * tell a torn snapshot from a consistent one. The writer is allowed to sleep
+ * pause microseconds between two updates, 0 updates back to back. */
+static void seqlockWriter(int pause) {
+    unsigned int seq = atomic_load_explicit(&seqlock->seq, memory_order_relaxed);
+    unsigned long gen = 0;
+    int i;
+    while (!atomic_load_explicit(&seqlock->stop, memory_order_relaxed)) {
+        ++gen;
+        atomic_store_explicit(&seqlock->seq, ++seq, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (i = 0; i < seqlock->len; ++i) {
+            atomic_store_explicit(&seqlock->data[i], (int)(gen + i), memory_order_relaxed);
+        }
+        atomic_store_explicit(&seqlock->seq, ++seq, memory_order_release);
+        if (pause > 0) usleep(pause);
+    }
+    seqlock->updates = gen;
+}
+
+// tells the CPU we are spinning, so a writer on the sibling hyperthread is not starved
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+/* Copies a consistent snapshot of the data in snap. Adds to *retries the
+ * copies thrown away because an update overlapped them, and to *spins the
+ * polls of the counter that found an update in progress. */
+static void seqlockRead(int *snap, int len, unsigned long *retries, unsigned long *spins) {
+    unsigned int begin, end;
+    int i;
+    while (1) {
+        begin = atomic_load_explicit(&seqlock->seq, memory_order_acquire);
+        if (begin & 1) {
+            // an update in progress, the copy would be torn
+            ++*spins;
+            cpuRelax();
+            continue;
+        }
+        for (i = 0; i < len; ++i) {
+            snap[i] = atomic_load_explicit(&seqlock->data[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        end = atomic_load_explicit(&seqlock->seq, memory_order_relaxed);
+        if (begin == end) return;
+        ++*retries;
+    }
+}
+
+static void seqlockReader(int id) {
+    int snap[SEQLOCK_MAX_PAYLOAD];
+    int len = seqlock->len, last = 0, i;
+    unsigned long reads = 0, retries = 0, spins = 0;
+    while (!atomic_load_explicit(&seqlock->stop, memory_order_relaxed)) {
+        seqlockRead(snap, len, &retries, &spins);
+        ++reads;
+
+        // a consistent snapshot is one generation, never older than the previous one
+        for (i = 0; i < len; ++i) {
+            if (snap[i] != snap[0] + i) {
+                fprintf(stderr, "reader %d: torn snapshot, data[%d] = %d, data[0] = %d\n", id, i, snap[i], snap[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (snap[0] < last) {
+            fprintf(stderr, "reader %d: snapshot of generation %d after %d\n", id, snap[0], last);
+            exit(EXIT_FAILURE);
+        }
+        last = snap[0];
+    }
+    seqlock->readers[id].reads = reads;
+    seqlock->readers[id].retries = retries;
+    seqlock->readers[id].spins = spins;
+}
+
+int runSeqlock(int readers, int milliseconds, int len, int pause) {
+    if (readers < 1 || readers > SEQLOCK_MAX_READERS || len < 1 || len > SEQLOCK_MAX_PAYLOAD || milliseconds < 1) {
+        fprintf(stderr, "seqlock: between 1 and %d readers, between 1 and %d ints, at least 1 ms\n",
+                SEQLOCK_MAX_READERS, SEQLOCK_MAX_PAYLOAD);
+        return EXIT_FAILURE;
+    }
+
+    shm_unlink(SEQLOCK_SHM_NAME);
+    int fd = shm_open(SEQLOCK_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) handle_error("shm_open error");
+    if (ftruncate(fd, sizeof(seqlock_t)) == -1) handle_error("ftruncate error");
+    seqlock = mmap(0, sizeof(seqlock_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (seqlock == MAP_FAILED) handle_error("mmap error");
+    if (close(fd) == -1) handle_error("close error");
+
+    // the segment is zero-filled: sequence 0 and generation 0 (data[i] = i)
+    seqlock->len = len;
+    int i;
+    for (i = 0; i < len; ++i) {
+        atomic_init(&seqlock->data[i], i);
+    }
+
+    fflush(stdout);
+    unsigned long start = now_ns();
+    for (i = -1; i < readers; ++i) {
+        pid_t pid = fork();
+        if (pid == -1) handle_error("main: fork");
+        if (pid == 0) {
+            if (i < 0) seqlockWriter(pause);
+            else seqlockReader(i);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    usleep(milliseconds * 1000);
+    atomic_store(&seqlock->stop, 1);
+
+    int status, ret;
+    for (i = -1; i < readers; ++i) {
+        ret = wait(&status);
+        if (ret == -1) handle_error("main: wait");
+        if (WEXITSTATUS(status)) handle_error_en(WEXITSTATUS(status), "reader or writer crashed");
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    unsigned long reads = 0, retries = 0, spins = 0;
+    printf("seqlock: %d readers, %d ints, %.3f s, writer %lu updates (%.0f updates/s, %d us pause)\n",
+           readers, len, seconds, seqlock->updates, seqlock->updates / seconds, pause);
+    printf("%8s %14s %14s %12s %14s\n", "reader", "reads/s", "retries", "retries/read", "spins");
+    for (i = 0; i < readers; ++i) {
+        seqlock_reader_t *r = &seqlock->readers[i];
+        printf("%8d %14.0f %14lu %12.4f %14lu\n", i, r->reads / seconds, r->retries,
+               r->reads ? (double)r->retries / r->reads : 0.0, r->spins);
+        reads += r->reads;
+        retries += r->retries;
+        spins += r->spins;
+    }
+    printf("%8s %14.0f %14lu %12.4f %14lu\n", "total", reads / seconds, retries,
+           reads ? (double)retries / reads : 0.0, spins);
+
+    if (munmap(seqlock, sizeof(seqlock_t)) == -1) handle_error("munmap error");
+    if (shm_unlink(SEQLOCK_SHM_NAME)) handle_error("shm_unlink error");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,327 @@
+#include "common.h"
+#include "../../01/performance.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Long-lived version of the request/worker pair. Instead of forking a worker,
+ * mapping the data and tearing everything down for every request, a server
+ * (req_wrk service serve) creates a shared segment and a pool of workers that
+ * keep running until it is stopped. The segment holds one request slot per
+ * requester and a queue of the submitted slots. A requester process
+ * (req_wrk service request) attaches to the segment, claims a free slot, and
+ * for every request fills the slot in place, queues it and sleeps on the
+ * slot's semaphore; a worker takes slots from the queue, transforms the data
+ * in place and wakes the owner. All the semaphores are unnamed and live in
+ * the segment (sem_init with pshared set).
+ *
+ * The payload is SERVICE_PAYLOAD ints, so the figures measure the cost of
+ * the handshake far more than the cost of the work.
+ */
+
+typedef struct {
+    sem_t done;                 // posted by the worker that completed the slot
+    int len;                    // ints of data in use
+    int data[SERVICE_PAYLOAD];
+} service_slot_t;
+
+typedef struct {
+    atomic_int ready;           // set once the server is up, cleared when it stops
+    pid_t server;
+    int workers;
+    sem_t lock;                 // protects head and tail
+    sem_t pending;              // submitted slots, plus one per worker to stop
+    unsigned int head, tail;    // queue[head % SERVICE_MAX_REQUESTERS] is the oldest
+    int queue[SERVICE_MAX_REQUESTERS];
+    atomic_int owner[SERVICE_MAX_REQUESTERS];   // pid of the requester of the slot, 0 if free
+    service_slot_t slots[SERVICE_MAX_REQUESTERS];
+    histogram latency[SERVICE_MAX_REQUESTERS];  // round trips, one per slot
+    atomic_ulong served[SERVICE_MAX_WORKERS];
+} service_t;
+
+service_t *service;
+
+// pushes (or pops, if slot is -1) the queue of submitted slots
+static int serviceQueue(int slot) {
+    if (sem_wait(&service->lock) != 0) handle_error("sem_wait error, sem: lock");
+    if (slot >= 0) {
+        service->queue[service->tail++ % SERVICE_MAX_REQUESTERS] = slot;
+    } else if (service->head != service->tail) {
+        slot = service->queue[service->head++ % SERVICE_MAX_REQUESTERS];
+    }
+    if (sem_post(&service->lock) != 0) handle_error("sem_post error, sem: lock");
+    return slot;
+}
+
+static void serviceWorker(int id) {
+    while (1) {
+        if (sem_wait(&service->pending) != 0) handle_error("sem_wait error, sem: pending");
+        // the queue is empty only when the token is a request to stop
+        int slot = serviceQueue(-1);
+        if (slot < 0) break;
+
+        service_slot_t *s = &service->slots[slot];
+        int i;
+        for (i = 0; i < s->len; ++i) {
+            s->data[i] = s->data[i] * s->data[i];
+        }
+        atomic_fetch_add_explicit(&service->served[id], 1, memory_order_relaxed);
+
+        if (sem_post(&s->done) != 0) handle_error("sem_post error, sem: done");
+    }
+}
+
+// maps the segment of a running server, NULL if there is none
+static service_t *serviceAttach() {
+    int fd = shm_open(SERVICE_SHM_NAME, O_RDWR, 0);
+    if (fd < 0) {
+        if (errno == ENOENT) return NULL;
+        handle_error("shm_open error");
+    }
+    service_t *s = mmap(0, sizeof(service_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (s == MAP_FAILED) handle_error("mmap error");
+    if (close(fd) == -1) handle_error("close error");
+    if (!atomic_load(&s->ready) || kill(s->server, 0) != 0) {
+        if (munmap(s, sizeof(service_t)) == -1) handle_error("munmap error");
+        return NULL;
+    }
+    return s;
+}
+
+static volatile sig_atomic_t stopRequested;
+
+static void serviceStopHandler(int sig) {
+    stopRequested = 1;
+}
+
+/* Runs the server until SIGINT or SIGTERM (req_wrk service stop): creates the
+ * segment, forks the workers, then stops them and removes the segment. */
+int serveService(int workers, int verbose) {
+    if (workers < 1 || workers > SERVICE_MAX_WORKERS) {
+        fprintf(stderr, "service: between 1 and %d workers\n", SERVICE_MAX_WORKERS);
+        return EXIT_FAILURE;
+    }
+    service_t *running = serviceAttach();
+    if (running != NULL) {
+        fprintf(stderr, "service: a server is already running (pid %d)\n", running->server);
+        return EXIT_FAILURE;
+    }
+
+    shm_unlink(SERVICE_SHM_NAME);
+    int fd = shm_open(SERVICE_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) handle_error("shm_open error");
+    if (ftruncate(fd, sizeof(service_t)) == -1) handle_error("ftruncate error");
+    service = mmap(0, sizeof(service_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (service == MAP_FAILED) handle_error("mmap error");
+    if (close(fd) == -1) handle_error("close error");
+
+    // the segment is zero-filled (all the slots free), only the semaphores need an init
+    if (sem_init(&service->lock, 1, 1) != 0) handle_error("sem_init error, sem: lock");
+    if (sem_init(&service->pending, 1, 0) != 0) handle_error("sem_init error, sem: pending");
+    int i;
+    for (i = 0; i < SERVICE_MAX_REQUESTERS; ++i) {
+        if (sem_init(&service->slots[i].done, 1, 0) != 0) handle_error("sem_init error, sem: done");
+    }
+    service->server = getpid();
+    service->workers = workers;
+
+    // the signals are only taken in sigsuspend, so a stop cannot be missed
+    sigset_t stopSignals, oldMask;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &stopSignals, &oldMask) != 0) handle_error("sigprocmask error");
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serviceStopHandler;
+    if (sigaction(SIGINT, &sa, NULL) != 0 || sigaction(SIGTERM, &sa, NULL) != 0) handle_error("sigaction error");
+
+    // the workers leave on a stop token, not on the CTRL+C of the terminal
+    fflush(stdout);
+    for (i = 0; i < workers; ++i) {
+        pid_t pid = fork();
+        if (pid == -1) handle_error("main: fork");
+        if (pid == 0) {
+            signal(SIGINT, SIG_IGN);
+            signal(SIGTERM, SIG_IGN);
+            sigprocmask(SIG_SETMASK, &oldMask, NULL);
+            serviceWorker(i);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    atomic_store(&service->ready, 1);
+    if (verbose) {
+        printf("service: serving on %s with %d workers (pid %d), stop with CTRL+C or req_wrk service stop\n",
+               SERVICE_SHM_NAME, workers, getpid());
+        fflush(stdout);
+    }
+    while (!stopRequested) sigsuspend(&oldMask);
+    atomic_store(&service->ready, 0);
+
+    // one token per worker with an empty queue tells it to leave
+    for (i = 0; i < workers; ++i) {
+        if (sem_post(&service->pending) != 0) handle_error("sem_post error, sem: pending");
+    }
+    int status, ret;
+    for (i = 0; i < workers; ++i) {
+        ret = wait(&status);
+        if (ret == -1) handle_error("main: wait");
+        if (WEXITSTATUS(status)) handle_error_en(WEXITSTATUS(status), "worker crashed");
+    }
+
+    for (i = 0; i < workers; ++i) {
+        printf("service: worker %d served %lu requests\n", i, atomic_load(&service->served[i]));
+    }
+    fflush(stdout);
+
+    if (munmap(service, sizeof(service_t)) == -1) handle_error("munmap error");
+    if (shm_unlink(SERVICE_SHM_NAME)) handle_error("shm_unlink error");
+    return EXIT_SUCCESS;
+}
+
+/* Attaches to the running server, claims a free slot and performs requests
+ * round trips through it, recording them in the slot's histogram. */
+int requestService(int requests, int verbose) {
+    service = serviceAttach();
+    if (service == NULL) {
+        fprintf(stderr, "service: no server is running, start one with req_wrk service serve\n");
+        return EXIT_FAILURE;
+    }
+
+    int id, free = 0;
+    for (id = 0; id < SERVICE_MAX_REQUESTERS; ++id) {
+        free = 0;
+        if (atomic_compare_exchange_strong(&service->owner[id], &free, getpid())) break;
+    }
+    if (id == SERVICE_MAX_REQUESTERS) {
+        fprintf(stderr, "service: all the %d slots are taken\n", SERVICE_MAX_REQUESTERS);
+        return EXIT_FAILURE;
+    }
+
+    service_slot_t *s = &service->slots[id];
+    histogram *h = &service->latency[id];
+    hist_init(h);
+    // a previous owner killed during a request may have left a completion behind
+    while (sem_trywait(&s->done) == 0);
+
+    unsigned long start = now_ns();
+    int n, i;
+    for (n = 0; n < requests; ++n) {
+        unsigned long begin = now_ns();
+        s->len = SERVICE_PAYLOAD;
+        for (i = 0; i < s->len; ++i) {
+            s->data[i] = (n + i) % 1000;
+        }
+
+        serviceQueue(id);
+        if (sem_post(&service->pending) != 0) handle_error("sem_post error, sem: pending");
+        if (sem_wait(&s->done) != 0) handle_error("sem_wait error, sem: done");
+        hist_record(h, now_ns() - begin);
+
+        for (i = 0; i < s->len; ++i) {
+            if (s->data[i] != ((n + i) % 1000) * ((n + i) % 1000)) {
+                fprintf(stderr, "request %d: wrong result %d in slot %d\n", n, s->data[i], id);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    if (verbose) {
+        printf("service: %d requests of %d ints through slot %d in %.3f s (%.0f requests/s)\n",
+               requests, SERVICE_PAYLOAD, id, seconds, requests / seconds);
+        hist_print(h, "Round trip");
+    }
+
+    atomic_store(&service->owner[id], 0);
+    if (munmap(service, sizeof(service_t)) == -1) handle_error("munmap error");
+    return EXIT_SUCCESS;
+}
+
+int stopService() {
+    service_t *s = serviceAttach();
+    if (s == NULL) {
+        fprintf(stderr, "service: no server is running\n");
+        return EXIT_FAILURE;
+    }
+    printf("service: stopping the server (pid %d)\n", s->server);
+    if (kill(s->server, SIGTERM) != 0) handle_error("kill error");
+    if (munmap(s, sizeof(service_t)) == -1) handle_error("munmap error");
+    return EXIT_SUCCESS;
+}
+
+/* Benchmark driver: starts a server, runs the requester processes against
+ * it, each attaching to the segment as a standalone requester would, and
+ * stops the server at the end. */
+int runService(int requesters, int workers, int requests) {
+    if (requesters < 1 || requesters > SERVICE_MAX_REQUESTERS || workers < 1 || workers > SERVICE_MAX_WORKERS) {
+        fprintf(stderr, "service: between 1 and %d requesters, between 1 and %d workers\n",
+                SERVICE_MAX_REQUESTERS, SERVICE_MAX_WORKERS);
+        return EXIT_FAILURE;
+    }
+    if ((service = serviceAttach()) != NULL) {
+        fprintf(stderr, "service: a server is already running (pid %d), stop it first\n", service->server);
+        return EXIT_FAILURE;
+    }
+
+    fflush(stdout);
+    pid_t server = fork();
+    if (server == -1) handle_error("main: fork");
+    if (server == 0) _exit(serveService(workers, 0));
+
+    // wait for the server to be up
+    struct timespec pause = { 0, 1000000 };
+    int i;
+    for (i = 0; i < 5000 && (service = serviceAttach()) == NULL; ++i) {
+        nanosleep(&pause, NULL);
+    }
+    if (service == NULL) {
+        fprintf(stderr, "service: the server did not start\n");
+        kill(server, SIGTERM);
+        return EXIT_FAILURE;
+    }
+
+    pid_t pids[SERVICE_MAX_REQUESTERS];
+    unsigned long start = now_ns();
+    for (i = 0; i < requesters; ++i) {
+        pids[i] = fork();
+        if (pids[i] == -1) handle_error("main: fork");
+        if (pids[i] == 0) _exit(requestService(requests, 0));
+    }
+
+    int status;
+    for (i = 0; i < requesters; ++i) {
+        if (waitpid(pids[i], &status, 0) == -1) handle_error("main: wait");
+        if (WEXITSTATUS(status)) handle_error_en(WEXITSTATUS(status), "requester crashed");
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    // the slots go away with the server
+    histogram total;
+    hist_init(&total);
+    for (i = 0; i < SERVICE_MAX_REQUESTERS; ++i) {
+        if (service->latency[i].count) hist_merge(&total, &service->latency[i]);
+    }
+    if (munmap(service, sizeof(service_t)) == -1) handle_error("munmap error");
+
+    printf("service: %d requesters, %d workers, %lu requests in %.3f s (%.0f requests/s)\n",
+           requesters, workers, total.count, seconds, total.count / seconds);
+    printf("service: %d ints per request, the figures are the cost of the handshake rather than of the work\n",
+           SERVICE_PAYLOAD);
+    fflush(stdout);
+
+    if (kill(server, SIGTERM) != 0) handle_error("kill error");
+    if (waitpid(server, &status, 0) == -1) handle_error("main: wait");
+    if (WEXITSTATUS(status)) handle_error_en(WEXITSTATUS(status), "server crashed");
+
+    hist_print(&total, "Round trip");
+    return EXIT_SUCCESS;
+}
@@ -11,14 +11,22 @@
 
 /* Configuration parameters */
 // macros for producer.c and consumer.c
+#ifndef BUFFER_SIZE
 #define BUFFER_SIZE         128
+#endif
 #define INITIAL_DEPOSIT     0
 #define MAX_TRANSACTION     1000
+#ifndef NUM_CONSUMERS
 #define NUM_CONSUMERS       2
+#endif
+#ifndef NUM_PRODUCERS
 #define NUM_PRODUCERS       4
+#endif
 #define PRNG_SEED           0
 
+#ifndef NUM_OPERATIONS
 #define NUM_OPERATIONS      400
+#endif
 #define OPS_PER_CONSUMER    (NUM_OPERATIONS/NUM_CONSUMERS)
 #define OPS_PER_PRODUCER    (NUM_OPERATIONS/NUM_PRODUCERS)
 
@@ -32,5 +40,19 @@
 #define SEMNAME_CS_CONS     "/mysemcscons"
 #define SH_MEM_NAME         "/mymem"
 
+// build with -DUSE_FSEM to replace the named semaphores with futex-based
+// ones kept in the shared memory (see ../../01/futex_sync.h)
+#ifdef USE_FSEM
+#include "../../01/futex_sync.h"
+#define SEM_T               fsem_t
+#define SEM_WAIT(s)         fsem_wait(s)
+#define SEM_POST(s)         fsem_post(s)
+#else
+#include <semaphore.h>
+#define SEM_T               sem_t
+#define SEM_WAIT(s)         sem_wait(s)
+#define SEM_POST(s)         sem_post(s)
+#endif
+
 
 #endif
@@ -17,6 +17,9 @@ struct shared_memory {
     int buf [BUFFER_SIZE];
     int read_index;
     int write_index;
+#ifdef USE_FSEM
+    fsem_t filled, empty, cs_prod, cs_cons;
+#endif
 };
 
 //definizione shared memory
@@ -24,7 +27,7 @@ struct shared_memory *myshm_ptr;
 int fd_shm;
 
 //definizione semafori named
-sem_t *sem_empty, *sem_filled, *sem_cs;
+SEM_T *sem_empty, *sem_filled, *sem_cs;
 
 void openMemory() {
     // request shared memory to the kernel and map the shared memory in the shared_mem_ptr variable
@@ -41,6 +44,11 @@ void closeMemory() {
 }
 
 void openSemaphores() {
+#ifdef USE_FSEM
+    sem_filled = &myshm_ptr->filled;
+    sem_empty = &myshm_ptr->empty;
+    sem_cs = &myshm_ptr->cs_cons;
+#else
     sem_filled = sem_open(SEMNAME_FILLED, 0);
     if (sem_filled == SEM_FAILED) handle_error("sem_open filled");
 
@@ -50,9 +58,11 @@ void openSemaphores() {
     sem_cs = sem_open(SEMNAME_CS_CONS, O_CREAT | O_EXCL, 0600, 1);
     if (sem_cs == SEM_FAILED) handle_error("sem_open cs cons");
 
+#endif
 }
 
 void closeAndDestroySemaphores() {
+#ifndef USE_FSEM // otherwise they go away with the shared memory
     int ret;
 
     // first close
@@ -78,15 +88,16 @@ void closeAndDestroySemaphores() {
     ret = sem_unlink(SEMNAME_CS_CONS);
     if (ret) handle_error("sem_unlink cs cons");
 
+#endif
 }
 
 void consume(int id, int numOps) {
     int localSum = 0;
     while (numOps > 0) {
-        int ret = sem_wait(sem_filled);
+        int ret = SEM_WAIT(sem_filled);
         if (ret) handle_error("sem_wait filled");
 
-        ret = sem_wait(sem_cs);
+        ret = SEM_WAIT(sem_cs);
         if (ret) handle_error("sem_wait cs");
         
         // read value from buffer inside the shared memory and update the consumer position
@@ -94,10 +105,10 @@ void consume(int id, int numOps) {
         myshm_ptr->read_index++;
         if (myshm_ptr->read_index == BUFFER_SIZE) myshm_ptr->read_index = 0;
 
-        ret = sem_post(sem_cs);
+        ret = SEM_POST(sem_cs);
         if (ret) handle_error("sem_post cs");
 
-        ret = sem_post(sem_empty);
+        ret = SEM_POST(sem_empty);
         if (ret) handle_error("sem_post empty");
 
         localSum += value;
@@ -108,8 +119,8 @@ void consume(int id, int numOps) {
 
 int main(int argc, char** argv) {
 
-    openSemaphores();
     openMemory();
+    openSemaphores();
 
     int i;
     for (i=0; i<NUM_CONSUMERS; ++i) {
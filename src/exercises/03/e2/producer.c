@@ -3,7 +3,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
-#include <time.h>       // nanosleep()
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -11,12 +10,16 @@
 #include <sys/mman.h>
 #include <sys/wait.h>
 #include "common.h"
+#include "../../01/workload.h"
 
 // definizione struttura memoria
 struct shared_memory {
     int buf [BUFFER_SIZE];
     int read_index;
     int write_index;
+#ifdef USE_FSEM
+    fsem_t filled, empty, cs_prod, cs_cons;
+#endif
 };
 
 //definizione shared memory
@@ -24,7 +27,7 @@ struct shared_memory *myshm_ptr;
 int fd_shm;
 
 //definizione semafori named
-sem_t *sem_empty, *sem_filled, *sem_cs;
+SEM_T *sem_empty, *sem_filled, *sem_cs;
 
 void initMemory() {
     
@@ -51,6 +54,16 @@ void closeMemory() {
 }
 
 void initSemaphores() {
+#ifdef USE_FSEM
+    // the semaphores live in the shared memory, consumers included
+    if (fsem_init(&myshm_ptr->filled, 1, 0)) handle_error("fsem_init filled");
+    if (fsem_init(&myshm_ptr->empty, 1, BUFFER_SIZE)) handle_error("fsem_init empty");
+    if (fsem_init(&myshm_ptr->cs_prod, 1, 1)) handle_error("fsem_init cs prod");
+    if (fsem_init(&myshm_ptr->cs_cons, 1, 1)) handle_error("fsem_init cs cons");
+    sem_filled = &myshm_ptr->filled;
+    sem_empty = &myshm_ptr->empty;
+    sem_cs = &myshm_ptr->cs_prod;
+#else
     // delete state semaphores from a previous crash (if any)
     sem_unlink(SEMNAME_FILLED);
     sem_unlink(SEMNAME_EMPTY);
@@ -65,9 +78,11 @@ void initSemaphores() {
 
     sem_cs = sem_open(SEMNAME_CS_PROD, O_CREAT | O_EXCL, 0600, 1);
     if (sem_cs == SEM_FAILED) handle_error("sem_open cs prod");
+#endif
 }
 
 void closeSemaphores() {
+#ifndef USE_FSEM // otherwise they go away with the shared memory
     int ret = sem_close(sem_filled);
     if (ret) handle_error("sem_close filled");
 
@@ -76,32 +91,30 @@ void closeSemaphores() {
 
     ret = sem_close(sem_cs);
     if (ret) handle_error("sem_close cs");
+#endif
 }
 
+wl_config workload_cfg;
+workload wl;    // per process, producers are forked
+
 // generates a number between -MAX_TRANSACTION and +MAX_TRANSACTION
 static inline int performRandomTransaction() {
-    struct timespec pause = {0};
-    pause.tv_nsec = 10000000; // 10 ms (100*10^6 ns)
-    nanosleep(&pause, NULL);
-
-    int amount = rand() % (2 * MAX_TRANSACTION); // {0, ..., 2*MAX_TRANSACTION - 1}
-    if (amount >= MAX_TRANSACTION) {
-        return MAX_TRANSACTION - (amount+1); // {-MAX_TRANSACTION, ..., -1}
-    } else {
-        return amount + 1; // {1, ..., MAX_TRANSACTION}
-    }
+    return wl_transaction(&wl, MAX_TRANSACTION);
 }
 
 void produce(int id, int numOps) {
+    // each producer draws from its own generator, seeded from PRNG_SEED and its id
+    wl_init(&wl, &workload_cfg, PRNG_SEED, id);
+
     int localSum = 0;
     while (numOps > 0) {
         // producer, just do your thing!
         int value = performRandomTransaction();
 
-        int ret = sem_wait(sem_empty);
+        int ret = SEM_WAIT(sem_empty);
         if (ret) handle_error("sem_wait empty\n");
 
-        ret = sem_wait(sem_cs);
+        ret = SEM_WAIT(sem_cs);
         if (ret) handle_error("sem_wait cs");
 
         // write value in the buffer inside the shared memory and update the producer position
@@ -109,10 +122,10 @@ void produce(int id, int numOps) {
         myshm_ptr->write_index++;
         if (myshm_ptr->write_index == BUFFER_SIZE) myshm_ptr->write_index = 0;
 
-        ret = sem_post(sem_cs);
+        ret = SEM_POST(sem_cs);
         if (ret) handle_error("sem_post cs");
 
-        ret = sem_post(sem_filled);
+        ret = SEM_POST(sem_filled);
         if (ret) handle_error("sem_post filled");
 
         localSum += value;
@@ -122,9 +135,10 @@ void produce(int id, int numOps) {
 }
 
 int main(int argc, char** argv) {
-    srand(PRNG_SEED);
-    initSemaphores();
+    // service time of a transaction, from $WORKLOAD (default fixed:10ms)
+    if (wl_config_init(&workload_cfg, NULL)) handle_error_en(EINVAL, "invalid WORKLOAD");
     initMemory();
+    initSemaphores();
 
     int i, ret;
     for (i=0; i<NUM_PRODUCERS; ++i) {
@@ -3,7 +3,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
-#include <time.h>       // nanosleep()
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -11,6 +10,7 @@
 #include <sys/mman.h>
 #include <sys/wait.h>
 #include "common.h"
+#include "../../01/workload.h"
 
 // definizione struttura memoria
 struct shared_memory {
@@ -49,21 +49,18 @@ void closeMemory() {
     if (ret == -1) handle_error("shm_unlink error");
 }
 
+wl_config workload_cfg;
+workload wl;    // per process, producers are forked
+
 // generates a number between -MAX_TRANSACTION and +MAX_TRANSACTION
 static inline int performRandomTransaction() {
-    struct timespec pause = {0};
-    pause.tv_nsec = 10000000; // 10 ms (100*10^6 ns)
-    nanosleep(&pause, NULL);
-
-    int amount = rand() % (2 * MAX_TRANSACTION); // {0, ..., 2*MAX_TRANSACTION - 1}
-    if (amount >= MAX_TRANSACTION) {
-        return MAX_TRANSACTION - (amount+1); // {-MAX_TRANSACTION, ..., -1}
-    } else {
-        return amount + 1; // {1, ..., MAX_TRANSACTION}
-    }
+    return wl_transaction(&wl, MAX_TRANSACTION);
 }
 
 void produce(int id, int numOps) {
+    // each producer draws from its own generator, seeded from PRNG_SEED and its id
+    wl_init(&wl, &workload_cfg, PRNG_SEED, id);
+
     int localSum = 0, next_pos = 0;
     while (numOps > 0) {
         // producer, just do your thing!
@@ -84,7 +81,8 @@ void produce(int id, int numOps) {
 }
 
 int main(int argc, char** argv) {
-    srand(PRNG_SEED);
+    // service time of a transaction, from $WORKLOAD (default fixed:10ms)
+    if (wl_config_init(&workload_cfg, NULL)) handle_error_en(EINVAL, "invalid WORKLOAD");
     initMemory();
 
     produce(0, OPS_PER_PRODUCER);
@@ -93,4 +91,4 @@ int main(int argc, char** argv) {
     closeMemory();
 
     exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
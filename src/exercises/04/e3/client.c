@@ -8,6 +8,7 @@
 #include <sys/stat.h>  // mkfifo()
 
 #include "common.h"
+#include "../../01/async_log.h"
 
 int readOneByOne(int fd, char* buf, char separator);
 void writeMsg(int fd, char* buf, int size);
@@ -21,6 +22,10 @@ int main(int argc, char* argv[]) {
     char* quit_command = QUIT_COMMAND;
     size_t quit_command_len = strlen(quit_command);
 
+    // per-message traces go through the background logger
+    ret = log_init();
+    if(ret) handle_error_en(ret, "Cannot start the logger");
+
     echo_fifo = open(ECHO_FIFO_NAME, O_RDONLY);
     if(echo_fifo == -1) handle_error("Cannot open Echo FIFO for reading");
     client_fifo = open(CLNT_FIFO_NAME, O_WRONLY);
@@ -63,5 +68,6 @@ int main(int argc, char* argv[]) {
     ret = close(client_fifo);
     if(ret) handle_error("Cannot close Client FIFO");
 
+    log_shutdown();
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
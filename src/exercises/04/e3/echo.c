@@ -8,6 +8,7 @@
 #include <sys/stat.h>  // mkfifo()
 
 #include "common.h"
+#include "../../01/async_log.h"
 
 int readOneByOne(int fd, char* buf, char separator);
 void writeMsg(int fd, char* buf, int size);
@@ -36,6 +37,10 @@ int main(int argc, char* argv[]) {
     char* quit_command = QUIT_COMMAND;
     size_t quit_command_len = strlen(quit_command);
 
+    // per-message traces go through the background logger
+    ret = log_init();
+    if(ret) handle_error_en(ret, "Cannot start the logger");
+
     // Create the two FIFOs
     unlink(ECHO_FIFO_NAME);
     unlink(CLNT_FIFO_NAME);
@@ -73,5 +78,6 @@ int main(int argc, char* argv[]) {
 
     // close the descriptors and destroy the two FIFOs
     cleanFIFOs(echo_fifo, client_fifo);
+    log_shutdown();
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
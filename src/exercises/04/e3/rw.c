@@ -1,6 +1,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include "common.h"
+#include "../../01/async_log.h"
 
 int readOneByOne(int fd, char* buf, char separator) {
 
@@ -11,13 +12,14 @@ int readOneByOne(int fd, char* buf, char separator) {
         if (ret == -1 && errno == EINTR) continue;
         if (ret == -1) handle_error("Cannot read from FIFO");
         if (ret ==  0){
+            // error path: print synchronously, after what has been logged so far
+            log_flush();
             printf("%s\n",buf);
             fflush(stdout);
              handle_error_en(bytes_read,"Process has closed the FIFO unexpectedly! Exiting...");
         }
     } while(buf[bytes_read++] != separator);
-    printf("Read %d bytes\n",bytes_read);
-    fflush(stdout);
+    log_info("Read %d bytes\n",bytes_read);
     return bytes_read;
 }
 
@@ -31,6 +33,5 @@ void writeMsg(int fd, char* buf, int size) {
         if (ret == -1) handle_error("Cannot write to FIFO");
         bytes_sent += ret;
     }
-    printf("Sent %d bytes\n",bytes_sent);
-    fflush(stdout);
+    log_info("Sent %d bytes\n",bytes_sent);
 }
\ No newline at end of file
@@ -14,6 +14,7 @@
 
 // macros for error handling
 #include "common.h"
+#include "../../01/async_log.h"
 
 #define N 100 // child process count
 #define M 10 // thread per child process count
@@ -112,17 +113,17 @@ void* thread_function(void* x) {
     if(ret) {
         handle_error("sem_wait failed");
     }
-    printf("[Child#%d-Thread#%d] Entered into critical section!!!\n", args->child_id, args->thread_id);
+    log_info("[Child#%d-Thread#%d] Entered into critical section!!!\n", args->child_id, args->thread_id);
     
     int fd = open(FILENAME, O_WRONLY | O_APPEND);
     if (fd < 0) handle_error("error while opening file");
-    printf("[Child#%d-Thread#%d] File %s opened in append mode!!!\n", args->child_id, args->thread_id, FILENAME);	
+    log_info("[Child#%d-Thread#%d] File %s opened in append mode!!!\n", args->child_id, args->thread_id, FILENAME);	
     
     write(fd, &(args->child_id), sizeof(int));
-    printf("[Child#%d-Thread#%d] %d appended to file %s opened in append mode!!!\n", args->child_id, args->thread_id, args->child_id, FILENAME);	
+    log_info("[Child#%d-Thread#%d] %d appended to file %s opened in append mode!!!\n", args->child_id, args->thread_id, args->child_id, FILENAME);	
     
     close(fd);
-    printf("[Child#%d-Thread#%d] File %s closed!!!\n", args->child_id, args->thread_id, FILENAME);
+    log_info("[Child#%d-Thread#%d] File %s closed!!!\n", args->child_id, args->thread_id, FILENAME);
     
     // exit critical section
     ret = sem_post(criticalSection);
@@ -130,7 +131,7 @@ void* thread_function(void* x) {
         handle_error("sem_post failed");
     }
     
-    printf("[Child#%d-Thread#%d] Exited from critical section!!!\n", args->child_id, args->thread_id);
+    log_info("[Child#%d-Thread#%d] Exited from critical section!!!\n", args->child_id, args->thread_id);
     
     free(x);
     pthread_exit(NULL);
@@ -266,6 +267,14 @@ void childProcess(int child_id) {
         handle_error("sem_wait failed");
     }
     printf("[Child#%d] Notification to begin received!!!\n", child_id);
+    fflush(stdout);
+    
+    // the threads of this child log through a background writer, so that
+    // printing does not stretch the critical section
+    ret = log_init();
+    if (ret) {
+        handle_error_en(ret, "log_init failed");
+    }
     
     unsigned int thread_id = 0;
     pthread_t* thread_handlers = malloc(m * sizeof(pthread_t));
@@ -277,7 +286,7 @@ void childProcess(int child_id) {
         memset(thread_handlers, 0, m * sizeof(pthread_t));
         
         // create M threads
-        printf("[Child#%d] Creating %d threads...\n", child_id, m);
+        log_info("[Child#%d] Creating %d threads...\n", child_id, m);
         for (j = 0; j < m; j++) {
             thread_args_t *t_args = (thread_args_t *)malloc(sizeof(thread_args_t));
             t_args->child_id = child_id;
@@ -288,26 +297,27 @@ void childProcess(int child_id) {
             }
             
         }
-        printf("[Child#%d] %d threads created!!!\n", child_id, m);
+        log_info("[Child#%d] %d threads created!!!\n", child_id, m);
         
         // wait for their completion
-        printf("[Child#%d] Waiting for the end of the %d threads...\n", child_id, m);
+        log_info("[Child#%d] Waiting for the end of the %d threads...\n", child_id, m);
         for (j = 0; j < m; j++) {
             ret = pthread_join(thread_handlers[j], NULL);
             if(ret){
                 handle_error_en(ret, "pthread_join failed");
             }
         }
-        printf("[Child#%d] %d threads completed!!!\n", child_id, m);
+        log_info("[Child#%d] %d threads completed!!!\n", child_id, m);
         
-        printf("[Child#%d] Checking for end activities notification...\n", child_id);
+        log_info("[Child#%d] Checking for end activities notification...\n", child_id);
         
         if (*data) break;
         
-        printf("[Child#%d] Go on with activities!!!\n", child_id);
+        log_info("[Child#%d] Go on with activities!!!\n", child_id);
     } while(1);
     
     free(thread_handlers);
+    log_shutdown();
     
     printf("[Child#%d] Activities completed!!!\n", child_id);
     
@@ -0,0 +1,325 @@
+#include "../01/performance.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// macros for handling errors
+#define handle_error_en(en, msg)    do { errno = en; perror(msg); exit(EXIT_FAILURE); } while (0)
+#define handle_error(msg)           do { perror(msg); exit(EXIT_FAILURE); } while (0)
+
+#define MAX_PARAMS          8
+#define MAX_VALUES          64
+#define MAX_ARG_LEN         1024
+#define DEFAULT_REPEATS     3
+
+#define FORMAT_CSV          0
+#define FORMAT_JSON         1
+
+// a swept parameter, e.g. "-p threads=1,2,4,8" replaces {threads} in the command
+typedef struct {
+    char*   name;
+    char*   values[MAX_VALUES];
+    int     num_values;
+} param_t;
+
+// measurements of a single run of the benchmarked program
+typedef struct {
+    int             status;     // exit code, or 128+signal
+    unsigned long   wall_ns;
+    unsigned long   user_us;
+    unsigned long   sys_us;
+    long            maxrss_kb;
+    long            nvcsw;      // voluntary context switches, i.e. sleeps
+} run_t;
+
+param_t params[MAX_PARAMS];
+int num_params = 0;
+int repeats = DEFAULT_REPEATS, format = FORMAT_CSV, verbose = 0, timeout_s = 0;
+char* build_command = NULL;
+FILE* out;
+int first_record = 1;
+
+pid_t running_child = -1;
+
+static void alarm_handler(int sig_no) {
+    if (running_child > 0) kill(running_child, SIGKILL);
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "Syntax: %s [-r repeats] [-f csv|json] [-o output] [-b build_command] [-t timeout_s] [-v]\n"
+                    "          -p name=v1,v2,... [-p ...] -- program [args...]\n"
+                    "Every {name} in the build command and in the program arguments is replaced\n"
+                    "by the current value; all the combinations of values are run.\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+void parseParam(char* spec) {
+    if (num_params == MAX_PARAMS) { fprintf(stderr, "Too many parameters (max %d)\n", MAX_PARAMS); exit(EXIT_FAILURE); }
+
+    char* eq = strchr(spec, '=');
+    if (eq == NULL || eq == spec) { fprintf(stderr, "Bad parameter %s, expected name=v1,v2,...\n", spec); exit(EXIT_FAILURE); }
+    *eq = '\0';
+
+    param_t* p = &params[num_params++];
+    p->name = spec;
+    p->num_values = 0;
+
+    char* saveptr;
+    char* value = strtok_r(eq + 1, ",", &saveptr);
+    while (value != NULL) {
+        if (p->num_values == MAX_VALUES) { fprintf(stderr, "Too many values for %s (max %d)\n", p->name, MAX_VALUES); exit(EXIT_FAILURE); }
+        p->values[p->num_values++] = value;
+        value = strtok_r(NULL, ",", &saveptr);
+    }
+    if (p->num_values == 0) { fprintf(stderr, "No values for parameter %s\n", p->name); exit(EXIT_FAILURE); }
+}
+
+// copies src into dst replacing every {name} with the value selected by idx
+void substitute(char* dst, const char* src, const int* idx) {
+    int len = 0;
+    while (*src) {
+        int matched = 0;
+        if (*src == '{') {
+            int i;
+            for (i = 0; i < num_params; i++) {
+                size_t n = strlen(params[i].name);
+                if (strncmp(src + 1, params[i].name, n) == 0 && src[n + 1] == '}') {
+                    const char* v = params[i].values[idx[i]];
+                    size_t vlen = strlen(v);
+                    if (len + vlen >= MAX_ARG_LEN) { fprintf(stderr, "Argument too long\n"); exit(EXIT_FAILURE); }
+                    memcpy(dst + len, v, vlen);
+                    len += vlen;
+                    src += n + 2;
+                    matched = 1;
+                    break;
+                }
+            }
+        }
+        if (!matched) {
+            if (len + 1 >= MAX_ARG_LEN) { fprintf(stderr, "Argument too long\n"); exit(EXIT_FAILURE); }
+            dst[len++] = *src++;
+        }
+    }
+    dst[len] = '\0';
+}
+
+// runs argv (or "sh -c argv[0]" if shell is set) and fills in the measurements
+void runOnce(char** argv, int shell, run_t* r) {
+    timer t;
+    struct rusage usage;
+    int status;
+
+    begin(&t);
+    pid_t pid = fork();
+    if (pid == -1) handle_error("fork");
+    if (pid == 0) {
+        // the benchmarked programs must not wait for the keyboard or flood the terminal
+        int devnull = open("/dev/null", O_RDWR);
+        if (devnull < 0) handle_error("open /dev/null");
+        dup2(devnull, STDIN_FILENO);
+        if (!verbose) dup2(devnull, STDOUT_FILENO);
+        if (shell) execl("/bin/sh", "sh", "-c", argv[0], (char*)NULL);
+        else execvp(argv[0], argv);
+        perror("exec");
+        _exit(127);
+    }
+
+    running_child = pid;
+    if (timeout_s > 0) alarm(timeout_s);
+    while (wait4(pid, &status, 0, &usage) == -1) {
+        if (errno != EINTR) handle_error("wait4");
+    }
+    alarm(0);
+    running_child = -1;
+    end(&t);
+
+    r->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    r->wall_ns = get_nanoseconds(&t);
+    r->user_us = usage.ru_utime.tv_sec * 1000000UL + usage.ru_utime.tv_usec;
+    r->sys_us = usage.ru_stime.tv_sec * 1000000UL + usage.ru_stime.tv_usec;
+    r->maxrss_kb = usage.ru_maxrss;
+    r->nvcsw = usage.ru_nvcsw;
+}
+
+void printHeader() {
+    if (format == FORMAT_JSON) {
+        fprintf(out, "[\n");
+        return;
+    }
+    int i;
+    for (i = 0; i < num_params; i++)
+        fprintf(out, "%s,", params[i].name);
+    fprintf(out, "run,status,wall_ns,user_us,sys_us,maxrss_kb,nvcsw\n");
+}
+
+// writes s as a JSON string, with quotes, backslashes and control characters escaped
+static void printJsonString(const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+// writes v unquoted if it is a JSON number, so that numeric sweeps compare as numbers
+static void printJsonValue(const char* v) {
+    const char* p = v;
+    if (*p == '-') p++;
+    int ok = *p >= '0' && *p <= '9' && !(*p == '0' && p[1] >= '0' && p[1] <= '9');
+    while (*p >= '0' && *p <= '9') p++;
+    if (ok && *p == '.') {
+        p++;
+        ok = *p >= '0' && *p <= '9';
+        while (*p >= '0' && *p <= '9') p++;
+    }
+    if (ok && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (*p == '+' || *p == '-') p++;
+        ok = *p >= '0' && *p <= '9';
+        while (*p >= '0' && *p <= '9') p++;
+    }
+    if (ok && *p == '\0') fputs(v, out);
+    else printJsonString(v);
+}
+
+void printRecord(const int* idx, int run, const run_t* r) {
+    int i;
+    if (format == FORMAT_JSON) {
+        fprintf(out, "%s  {", first_record ? "" : ",\n");
+        for (i = 0; i < num_params; i++) {
+            printJsonString(params[i].name);
+            fprintf(out, ": ");
+            printJsonValue(params[i].values[idx[i]]);
+            fprintf(out, ", ");
+        }
+        fprintf(out, "\"run\": %d, \"status\": %d, \"wall_ns\": %lu, \"user_us\": %lu, \"sys_us\": %lu, \"maxrss_kb\": %ld, \"nvcsw\": %ld}",
+                run, r->status, r->wall_ns, r->user_us, r->sys_us, r->maxrss_kb, r->nvcsw);
+    } else {
+        for (i = 0; i < num_params; i++)
+            fprintf(out, "%s,", params[i].values[idx[i]]);
+        fprintf(out, "%d,%d,%lu,%lu,%lu,%ld,%ld\n", run, r->status, r->wall_ns, r->user_us, r->sys_us, r->maxrss_kb, r->nvcsw);
+    }
+    first_record = 0;
+    fflush(out);
+}
+
+void printFooter() {
+    if (format == FORMAT_JSON) fprintf(out, "%s]\n", first_record ? "" : "\n");
+}
+
+static int compareRuns(const void* a, const void* b) {
+    unsigned long x = ((const run_t*)a)->wall_ns, y = ((const run_t*)b)->wall_ns;
+    return (x > y) - (x < y);
+}
+
+// runs all the repetitions for the combination selected by idx
+void runCombination(const int* idx, char** cmd, int cmd_len) {
+    int i;
+    char label[MAX_ARG_LEN] = "";
+    for (i = 0; i < num_params; i++) {
+        size_t len = strlen(label);
+        snprintf(label + len, sizeof(label) - len, "%s%s=%s", i ? " " : "", params[i].name, params[i].values[idx[i]]);
+    }
+
+    if (build_command != NULL) {
+        char build[MAX_ARG_LEN];
+        char* build_argv[] = { build, NULL };
+        run_t r;
+        substitute(build, build_command, idx);
+        runOnce(build_argv, 1, &r);
+        if (r.status != 0) {
+            fprintf(stderr, "[bench] %s: build failed with status %d, skipping\n", label, r.status);
+            return;
+        }
+    }
+
+    char** argv = malloc((cmd_len + 1) * sizeof(char*));
+    for (i = 0; i < cmd_len; i++) {
+        argv[i] = malloc(MAX_ARG_LEN);
+        substitute(argv[i], cmd[i], idx);
+    }
+    argv[cmd_len] = NULL;
+
+    run_t* runs = malloc(repeats * sizeof(run_t));
+    int failures = 0;
+    for (i = 0; i < repeats; i++) {
+        runOnce(argv, 0, &runs[i]);
+        printRecord(idx, i, &runs[i]);
+        if (runs[i].status != 0) failures++;
+    }
+
+    qsort(runs, repeats, sizeof(run_t), compareRuns);
+    fprintf(stderr, "[bench] %s: min %.3f ms, median %.3f ms, max %.3f ms%s\n", label,
+            runs[0].wall_ns / 1e6, runs[repeats / 2].wall_ns / 1e6, runs[repeats - 1].wall_ns / 1e6,
+            failures ? " (some runs FAILED)" : "");
+
+    for (i = 0; i < cmd_len; i++)
+        free(argv[i]);
+    free(argv);
+    free(runs);
+}
+
+int main(int argc, char* argv[]) {
+    char* output = NULL;
+    int opt;
+
+    out = stdout;
+    while ((opt = getopt(argc, argv, "r:f:o:b:t:p:v")) != -1) {
+        switch (opt) {
+            case 'r': repeats = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            case 'b': build_command = optarg; break;
+            case 't': timeout_s = atoi(optarg); break;
+            case 'p': parseParam(optarg); break;
+            case 'v': verbose = 1; break;
+            case 'f':
+                if (strcmp(optarg, "csv") == 0) format = FORMAT_CSV;
+                else if (strcmp(optarg, "json") == 0) format = FORMAT_JSON;
+                else usage(argv[0]);
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind >= argc || repeats <= 0) usage(argv[0]);
+
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) handle_error("Could not open the output file");
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &alarm_handler;
+    sigaction(SIGALRM, &action, NULL);
+
+    perf_calibrate();
+    printHeader();
+
+    // odometer over the cartesian product of all the parameter values
+    int idx[MAX_PARAMS] = {0};
+    while (1) {
+        runCombination(idx, argv + optind, argc - optind);
+
+        int i = num_params - 1;
+        while (i >= 0 && ++idx[i] == params[i].num_values) {
+            idx[i] = 0;
+            i--;
+        }
+        if (i < 0) break;
+    }
+
+    printFooter();
+    if (out != stdout && fclose(out) == EOF) handle_error("Could not close the output file");
+    exit(EXIT_SUCCESS);
+}